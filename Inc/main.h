@@ -81,6 +81,9 @@ void Error_Handler(void);
 #define B1_Pin GPIO_PIN_13
 #define B1_GPIO_Port GPIOC
 #define B1_EXTI_IRQn EXTI15_10_IRQn
+#define LIMIT0_Pin GPIO_PIN_0
+#define LIMIT0_GPIO_Port GPIOA
+#define LIMIT0_EXTI_IRQn EXTI0_IRQn
 /* USER CODE BEGIN Private defines */
 
 /* USER CODE END Private defines */
@@ -0,0 +1,107 @@
+#include <stdint.h>
+#include "gcode_parser.h"
+
+// G-code parser (1 line to 1 block)
+// Words are a letter and a number. Numbers are fixed point (x GCODE_SCALE,
+// decimals after the 3rd are truncated), so no float and no heap is used.
+// Comments "( ... )" and "; ..." and spaces are skipped, and letters are
+// not case sensitive. A letter without number is 0 (e.g. "G28 X"). G words
+// can be repeated in a line (e.g. "G90 G1"), other letters can not.
+// No HAL dependency : tools/gcode_bench.c builds this file on host.
+
+#define GCODE_INTEGER_MAX   (2147482)       // integer part limit (value x GCODE_SCALE fits int32_t)
+
+// Private functions definition
+static uint32_t GcodeParseNumber( const char* pLine, uint32_t length, uint32_t* pPos, int32_t* pValue );
+
+// function : Parse number at *pPos ( return 0 : not a number )
+static uint32_t GcodeParseNumber( const char* pLine, uint32_t length, uint32_t* pPos, int32_t* pValue )
+{
+    uint32_t pos      = *pPos;
+    uint32_t negative = 0;
+    uint32_t digits   = 0;
+    int32_t  integer  = 0;
+    int32_t  fraction = 0;
+    int32_t  scale    = GCODE_SCALE;
+
+    while( (pos < length) && (pLine[pos] == ' ') )  pos++;
+    uint32_t start = pos;
+    if( (pos < length) && ((pLine[pos] == '-') || (pLine[pos] == '+')) ){
+        negative = (pLine[pos] == '-') ? 1 : 0;
+        pos++;
+    }
+    // Integer part
+    while( (pos < length) && (pLine[pos] >= '0') && (pLine[pos] <= '9') ){
+        integer = (integer * 10) + (pLine[pos] - '0');
+        if( integer > GCODE_INTEGER_MAX )   return 0;
+        digits++;
+        pos++;
+    }
+    // Fraction part
+    if( (pos < length) && (pLine[pos] == '.') ){
+        pos++;
+        while( (pos < length) && (pLine[pos] >= '0') && (pLine[pos] <= '9') ){
+            if( scale > 1 ){
+                scale   /= 10;
+                fraction += (pLine[pos] - '0') * scale;
+            }
+            digits++;
+            pos++;
+        }
+    }
+    if( digits == 0 ){
+        // Letter only (e.g. "G28 X") is 0, a sign or a point only is an error
+        if( pos != start )  return 0;
+        *pValue = 0;
+        *pPos   = pos;
+        return 1;
+    }
+
+    int32_t value = (integer * GCODE_SCALE) + fraction;
+    *pValue = (negative != 0) ? -value : value;
+    *pPos   = pos;
+    return 1;
+}
+
+// function : Parse 1 line (without line end)
+GCODE_PARSE GcodeParse( const char* pLine, uint32_t length, GCODE_BLOCK* const pBlock )
+{
+    uint32_t pos = 0;
+    pBlock->mask    = 0;
+    pBlock->g_count = 0;
+
+    while( pos < length ){
+        char letter = pLine[pos];
+        pos++;
+
+        // Spaces and comments
+        if( (letter == ' ') || (letter == '\t') )   continue;
+        if( letter == ';' )     break;
+        if( letter == '(' ){
+            while( (pos < length) && (pLine[pos] != ')') )  pos++;
+            if( pos >= length )     return GCP_ERROR_COMMENT;
+            pos++;
+            continue;
+        }
+
+        // Word
+        if( (letter >= 'a') && (letter <= 'z') )    letter = (char)(letter - 'a' + 'A');
+        if( (letter < 'A') || (letter > 'Z') )      return GCP_ERROR_LETTER;
+        int32_t value;
+        if( GcodeParseNumber( pLine, length, &pos, &value ) == 0 )  return GCP_ERROR_NUMBER;
+
+        if( letter == 'G' ){
+            if( pBlock->g_count >= GCODE_G_MAX )    return GCP_ERROR_REPEAT;
+            pBlock->g[pBlock->g_count] = value;
+            pBlock->g_count++;
+            continue;
+        }
+        uint32_t bit = (uint32_t)1 << (letter - 'A');
+        if( (pBlock->mask & bit) != 0 )     return GCP_ERROR_REPEAT;
+        pBlock->mask |= bit;
+        pBlock->value[letter - 'A'] = value;
+    }
+
+    if( (pBlock->mask == 0) && (pBlock->g_count == 0) )     return GCP_EMPTY;
+    return GCP_OK;
+}
@@ -0,0 +1,29 @@
+// G-code number scale (value x1000 : 0.001 mm)
+#define GCODE_SCALE         (1000)
+#define GCODE_G_MAX         (4)         // G words per line
+
+// Word is in the block
+#define GCODE_HAS_WORD(pBlock,letter)   ((((pBlock)->mask) >> ((letter) - 'A')) & 1)
+// Word value (x GCODE_SCALE)
+#define GCODE_WORD(pBlock,letter)       ((pBlock)->value[(letter) - 'A'])
+
+// Parse result
+typedef enum {
+    GCP_OK          = 0,    // words parsed
+    GCP_EMPTY,              // no word (blank line, comment only)
+    GCP_ERROR_LETTER,       // not a letter
+    GCP_ERROR_NUMBER,       // sign or point without digits, number too large
+    GCP_ERROR_REPEAT,       // same letter twice, too many G words
+    GCP_ERROR_COMMENT,      // comment is not closed
+    GCP_MAX,                // the number of parse results
+}GCODE_PARSE;
+
+// Block (words of 1 line)
+typedef struct {
+    uint32_t            mask;                   // (1 << (letter - 'A')) : word is in the line
+    int32_t             value[26];              // value of letters A-Z (x GCODE_SCALE, not G)
+    uint32_t            g_count;                // the number of G words
+    int32_t             g[GCODE_G_MAX];         // G words (x GCODE_SCALE)
+}GCODE_BLOCK;
+
+GCODE_PARSE GcodeParse( const char* pLine, uint32_t length, GCODE_BLOCK* const pBlock );
\ No newline at end of file
@@ -0,0 +1,206 @@
+#include "stm32f4xx_hal.h"
+#include "main.h"
+#include "input_port.h"
+#include "motor_home.h"
+#include "scheduler.h"
+
+// Debounced inputs
+// EXTI callback only puts the edge time into the edge queue and wakes up the
+// input task. InputControl() (main loop) takes the edges and runs the
+// debouncer once per tick for all inputs, and debounced changes are put into
+// the event queue as INE_PRESS / INE_RELEASE for InputGetEvent().
+// Limit switches go through the queue too, but the motor is stopped and the
+// position is latched in the EXTI callback before (motor_home.c), so the
+// debounce time does not move the origin.
+//
+// Queues are lock-free with 1 producer and 1 consumer: the producer writes
+// the entry and then head, the consumer reads the entry and then tail.
+// EXTI interrupts have the same priority (no nesting), so all edges have 1
+// producer.
+#define INPUT_QUEUE_SIZE    (16)        // entries (power of 2)
+#define INPUT_QUEUE_MASK    (INPUT_QUEUE_SIZE - 1)
+
+// Debounce mode
+typedef enum {
+    IND_STABLE      = 0,    // event after no edge for debounce ticks
+    IND_LEADING,            // event at the first edge, then no event for debounce ticks
+}INPUT_DEBOUNCE;
+
+// Input information structure
+typedef struct {
+    GPIO_TypeDef*       port;                   // GPIO PORT NUMBER
+    uint16_t            pin;                    // GPIO PIN NUMBER
+    GPIO_PinState       active_level;           // PIN STATE when active
+    INPUT_DEBOUNCE      debounce;               // debounce mode
+    uint32_t            debounce_ticks;         // debounce time (ms)
+    uint32_t            active;                 // debounced state (1 : active)
+    uint32_t            pending;                // 1 : edge is not checked yet
+    uint32_t            edge_tick;              // last edge time
+    uint32_t            event_tick;             // last event time
+}INPUT_INFO;
+
+// Input queue structure
+typedef struct {
+    volatile uint32_t   head;                   // next write count (producer)
+    volatile uint32_t   tail;                   // next read count (consumer)
+    uint32_t            lost;                   // entries lost by overflow
+    INPUT_EVENT         event[INPUT_QUEUE_SIZE];// entries
+}INPUT_QUEUE;
+
+// Input information
+static INPUT_INFO       inputs[INP_MAX] = {
+    {   // B1 (active low)
+        B1_GPIO_Port,   // port
+        B1_Pin,         // pin
+        GPIO_PIN_RESET, // active level
+        IND_STABLE,     // debounce mode
+        20,             // debounce time (ms)
+        0,              // debounced state
+        0,              // pending
+        0,              // last edge time
+        0,              // last event time
+    },
+    {   // LIMIT0 (active low, event at the first edge)
+        LIMIT0_GPIO_Port,   // port
+        LIMIT0_Pin,     // pin
+        GPIO_PIN_RESET, // active level
+        IND_LEADING,    // debounce mode
+        10,             // debounce time (ms)
+        0,              // debounced state
+        0,              // pending
+        0,              // last edge time
+        0,              // last event time
+    },
+};
+
+static INPUT_QUEUE      s_EdgeQueue;
+static INPUT_QUEUE      s_EventQueue;
+static uint32_t         s_InputTick = 0;
+
+// Private functions definition
+static uint32_t InputQueuePush( INPUT_QUEUE* const pQue, uint16_t nInput, INPUT_EVENT_TYPE type, uint32_t tick );
+static uint32_t InputQueuePop( INPUT_QUEUE* const pQue, INPUT_EVENT* const pEvent );
+static uint32_t InputRead( const INPUT_INFO* const pIn );
+static void InputUpdate( uint16_t nInput, INPUT_INFO* const pIn, uint32_t now );
+
+// function : Put 1 entry (producer only)
+static uint32_t InputQueuePush( INPUT_QUEUE* const pQue, uint16_t nInput, INPUT_EVENT_TYPE type, uint32_t tick )
+{
+    uint32_t head = pQue->head;
+    if( (head - pQue->tail) >= INPUT_QUEUE_SIZE ){
+        pQue->lost++;
+        return 0;
+    }
+
+    INPUT_EVENT* pEvent = &(pQue->event[head & INPUT_QUEUE_MASK]);
+    pEvent->input    = (uint8_t)nInput;
+    pEvent->type     = (uint8_t)type;
+    pEvent->reserved = 0;
+    pEvent->tick     = tick;
+    __DMB();
+    pQue->head = head + 1;
+    return 1;
+}
+
+// function : Get 1 entry (consumer only)
+static uint32_t InputQueuePop( INPUT_QUEUE* const pQue, INPUT_EVENT* const pEvent )
+{
+    uint32_t tail = pQue->tail;
+    if( tail == pQue->head )    return 0;
+
+    __DMB();
+    *pEvent = pQue->event[tail & INPUT_QUEUE_MASK];
+    __DMB();
+    pQue->tail = tail + 1;
+    return 1;
+}
+
+// function : Read pin (1 : active)
+static uint32_t InputRead( const INPUT_INFO* const pIn )
+{
+    return (HAL_GPIO_ReadPin( pIn->port, pIn->pin ) == pIn->active_level) ? 1 : 0;
+}
+
+// function : Debounce 1 input
+static void InputUpdate( uint16_t nInput, INPUT_INFO* const pIn, uint32_t now )
+{
+    if( pIn->pending == 0 ) return;
+    if( pIn->debounce == IND_STABLE ){
+        if( (now - pIn->edge_tick) < pIn->debounce_ticks )  return;
+    }
+    else{
+        if( (now - pIn->event_tick) < pIn->debounce_ticks ) return;
+    }
+    pIn->pending = 0;
+
+    uint32_t active = InputRead( pIn );
+    if( active == pIn->active ) return;
+
+    pIn->active     = active;
+    pIn->event_tick = now;
+    InputQueuePush( &s_EventQueue, nInput, (active != 0) ? INE_PRESS : INE_RELEASE, pIn->edge_tick );
+}
+
+// function : Initialize for Inputs
+void InputInitialize( void )
+{
+    uint32_t now = HAL_GetTick();
+    for(uint16_t nInput=0; nInput < INP_MAX; nInput++ ){
+        inputs[nInput].active     = InputRead( &(inputs[nInput]) );
+        inputs[nInput].pending    = 0;
+        inputs[nInput].edge_tick  = now;
+        inputs[nInput].event_tick = now - inputs[nInput].debounce_ticks;
+    }
+    s_InputTick = now;
+}
+
+// function : Control for Inputs (call from main loop)
+// Debouncer runs once per tick, and also at once when edges are taken.
+void InputControl( void )
+{
+    INPUT_EVENT edge;
+    uint32_t    now   = HAL_GetTick();
+    uint32_t    edges = 0;
+
+    // Edges from EXTI
+    while( InputQueuePop( &s_EdgeQueue, &edge ) != 0 ){
+        INPUT_INFO* pIn = &(inputs[edge.input]);
+        if( (pIn->pending == 0) || (pIn->debounce == IND_STABLE) ) pIn->edge_tick = edge.tick;
+        pIn->pending = 1;
+        edges++;
+    }
+    if( (edges == 0) && (now == s_InputTick) )  return;
+    s_InputTick = now;
+
+    // Debounce
+    for(uint16_t nInput=0; nInput < INP_MAX; nInput++ ){
+        InputUpdate( nInput, &(inputs[nInput]), now );
+    }
+}
+
+// function : Get 1 debounced event (return 0 : no event)
+uint32_t InputGetEvent( INPUT_EVENT* pEvent )
+{
+    return InputQueuePop( &s_EventQueue, pEvent );
+}
+
+// function : Get debounced state (1 : active)
+uint32_t InputIsActive( uint16_t nInput )
+{
+    if( nInput > (INP_MAX - 1) )    return 0;
+
+    return inputs[nInput].active;
+}
+
+// function : EXTI callback (edge time only)
+void HAL_GPIO_EXTI_Callback( uint16_t GPIO_Pin )
+{
+    uint32_t now = HAL_GetTick();
+    // Limit switches : stop at the edge
+    MotorHomeExti( GPIO_Pin );
+    for(uint16_t nInput=0; nInput < INP_MAX; nInput++ ){
+        if( inputs[nInput].pin != GPIO_Pin )    continue;
+        InputQueuePush( &s_EdgeQueue, nInput, INE_EDGE, now );
+    }
+    SchedulerSignal( SEV_INPUT );
+}
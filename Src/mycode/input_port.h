@@ -0,0 +1,26 @@
+// Input number
+typedef enum {
+    INP_BUTTON0     = 0,    // B1 (user button)
+    INP_LIMIT0,             // LIMIT0 (limit switch of motor0)
+    INP_MAX,                // the number of inputs
+}INPUT_ID;
+
+// Input event type
+typedef enum {
+    INE_EDGE        = 0,    // raw edge (EXTI, internal)
+    INE_PRESS,              // debounced active
+    INE_RELEASE,            // debounced inactive
+}INPUT_EVENT_TYPE;
+
+// Input event structure
+typedef struct {
+    uint8_t             input;                  // input number (INPUT_ID)
+    uint8_t             type;                   // event type (INPUT_EVENT_TYPE)
+    uint16_t            reserved;
+    uint32_t            tick;                   // edge time (HAL tick, ms)
+}INPUT_EVENT;
+
+void InputInitialize( void );
+void InputControl( void );
+uint32_t InputGetEvent( INPUT_EVENT* pEvent );
+uint32_t InputIsActive( uint16_t nInput );
\ No newline at end of file
@@ -2,48 +2,85 @@
 #include "main.h"
 #include "interrupt_button.h"
 #include "stepping_motor.h"
+#include "input_port.h"
+#include "scheduler.h"
 
-static uint32_t s_ButtonState = 0;
+// Button state (input task toggles, plan task clears at the end of the test)
+// It is changed with interrupt disabled, so the RTOS threads do not preempt.
+static volatile uint32_t s_ButtonState = 0;
 static PHASE_MODE s_PhaseMode = MTP_PHASE_FULL;
 
-static void StartMotion(void);
+static void ButtonPress( void );
+static void InputProcess( void );
 
-void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+// function : Button press (debounced)
+static void ButtonPress( void )
 {
-    if( B1_Pin == GPIO_Pin ){
-        s_ButtonState = ~s_ButtonState;
-        MotorResetPosition( 0 );
-        MotorSetPhaseMode( 0, s_PhaseMode );
-
-        // 次回用
-        if( MTP_PHASE_FULL == s_PhaseMode ){
-            s_PhaseMode = MTP_PHASE_HALF;
-        }
-        else{
-            s_PhaseMode = MTP_PHASE_FULL;
+    uint32_t primask;
+    MOTOR_DISABLE_INTERRUPT( primask );
+    s_ButtonState = ~s_ButtonState;
+    MOTOR_ENABLE_INTERRUPT( primask );
+    SchedulerSignal( SEV_MOTOR );
+
+    // Position and phase mode are not changed while moving
+    if( 0 != MotorIsBusy(0) )  return;
+    MotorResetPosition( 0 );
+    MotorSetPhaseMode( 0, s_PhaseMode );
+
+    // 次回用
+    if( MTP_PHASE_FULL == s_PhaseMode ){
+        s_PhaseMode = MTP_PHASE_HALF;
+    }
+    else{
+        s_PhaseMode = MTP_PHASE_FULL;
+    }
+}
+
+// function : Input events
+static void InputProcess( void )
+{
+    INPUT_EVENT event;
+    while( InputGetEvent( &event ) != 0 ){
+        if( event.type != INE_PRESS )   continue;
+        switch( event.input ){
+            default:
+                break;
+            case INP_BUTTON0:
+                ButtonPress();
+                break;
+            case INP_LIMIT0:
+                // stopped and latched in EXTI (motor_home.c)
+                break;
         }
     }
 }
 
 void button_loop(void)
 {
-    if( 0 == s_ButtonState ) return;
-
-    StartMotion();
+    InputControl();
+    InputProcess();
 }
 
+// function : Motion planning (refill the segment queue of motor0)
+// The test moves are queued while the button state is on, so they run back
+// to back without waiting for the main loop.
 #define TEST_SIZE  (5)
-static void StartMotion(void)
+void button_plan(void)
 {
     static int32_t s_Index = 0;
     const static uint32_t s_pps[TEST_SIZE] = {1,2,10,50};
     const static int32_t s_pos[TEST_SIZE] = {8,16,46,96};
-    if(0 != MotorIsBusy(0))  return;
 
-    MotorMove( 0, s_pps[s_Index], s_pos[s_Index] );
-    s_Index++;
-    if( s_Index >= TEST_SIZE ){
-        s_Index = 0;
-        s_ButtonState = ~s_ButtonState;
+    while( 0 != s_ButtonState ){
+        // PPS 0 is not a move (skipped)
+        if( (0 != s_pps[s_Index]) && (0 == MotorQueueMove( 0, s_pps[s_Index], s_pos[s_Index] )) )  return;
+        s_Index++;
+        if( s_Index >= TEST_SIZE ){
+            uint32_t primask;
+            s_Index = 0;
+            MOTOR_DISABLE_INTERRUPT( primask );
+            s_ButtonState = 0;
+            MOTOR_ENABLE_INTERRUPT( primask );
+        }
     }
 }
@@ -1 +1,2 @@
-void button_loop(void);
\ No newline at end of file
+void button_loop(void);
+void button_plan(void);
\ No newline at end of file
@@ -1,18 +1,158 @@
 #include "stm32f4xx_hal.h"
+#include "main.h"
 #include "interrupt_timer.h"
 #include "stepping_motor.h"
+#include "motor_encoder.h"
 
 extern TIM_HandleTypeDef	htim2;
 static TIM_HandleTypeDef	*s_phTim = &htim2;
 
+// Cycles in the motion control (DWT cycle counter, free-running)
+static volatile uint32_t    s_ControlCycles = 0;
+
+#if TIMER_COMPARE_ENABLE
+// Tick is the TIM2 counter (free-running at INTERRUPT_TIMER_INTERVAL Hz).
+// CC1 : earliest deadline of the motors (MotorControl)
+// CC2 : encoder check every TIMER_ENCODER_PERIOD ticks
+// PSC is 16 bits, so the timer clock must be 65.536MHz or less
+// (84MHz SYSCLK : APB1 is divided by 4, the timer clock is 42MHz).
+#define TIMER_COMPARE_IRQ   (TIM_SR_CC1IF | TIM_SR_CC2IF)
+#define TIMER_PRESCALER_MAX (0x10000)
+#else
+// Tick is counted by the update interrupt
+static volatile uint32_t    s_Tick = 0;
+#endif
+
+// Private functions definition
+static void TimerControl( void );
+#if TIMER_COMPARE_ENABLE
+static void TimerEncoder( void );
+#endif
+
 void TimerInitialize( void )
 {
+#if TIMER_COMPARE_ENABLE
+    TIM_TypeDef* const pTim = s_phTim->Instance;
+    // Timer clock is x2 of PCLK1 when APB1 is divided
+    uint32_t clock = HAL_RCC_GetPCLK1Freq();
+    if( (RCC->CFGR & RCC_CFGR_PPRE1) != 0 ) clock *= 2;
+    // Counter can not run at the tick (prescaler overflow)
+    if( (clock / INTERRUPT_TIMER_INTERVAL) > TIMER_PRESCALER_MAX )  Error_Handler();
+
+    pTim->PSC   = (clock / INTERRUPT_TIMER_INTERVAL) - 1;
+    pTim->ARR   = 0xFFFFFFFF;
+    pTim->EGR   = TIM_EGR_UG;       // load prescaler, counter is 0
+    pTim->CCR1  = 0;
+    pTim->CCR2  = TIMER_ENCODER_PERIOD;
+    pTim->SR    = 0;
+    pTim->DIER  = TIM_DIER_CC1IE | TIM_DIER_CC2IE;
+    TimerSchedule( MotorControl( 0 ) );
+    __HAL_TIM_ENABLE( s_phTim );
+#else
     HAL_TIM_Base_Start_IT(s_phTim);
+#endif
+}
+
+// function : Motion control of 1 tick
+MOTOR_RAM_FUNC static void TimerControl( void )
+{
+    uint32_t start = DWT->CYCCNT;
+#if TIMER_COMPARE_ENABLE
+    TimerSchedule( MotorControl( s_phTim->Instance->CNT ) );
+#else
+    s_Tick++;
+    MotorControl( s_Tick );
+    MotorEncoderControl();
+#endif
+    s_ControlCycles += DWT->CYCCNT - start;
+}
+
+#if TIMER_COMPARE_ENABLE
+// function : Encoder check (CC2)
+MOTOR_RAM_FUNC static void TimerEncoder( void )
+{
+    uint32_t start = DWT->CYCCNT;
+    s_phTim->Instance->CCR2 += TIMER_ENCODER_PERIOD;
+    MotorEncoderControl();
+    s_ControlCycles += DWT->CYCCNT - start;
+}
+#endif
+
+// function : Get current tick
+MOTOR_RAM_FUNC uint32_t TimerGetTick( void )
+{
+#if TIMER_COMPARE_ENABLE
+    return s_phTim->Instance->CNT;
+#else
+    return s_Tick;
+#endif
+}
+
+// function : Set the next deadline of the motors (interrupt is disabled by caller, or in timer interrupt)
+// Periodic tick : nothing to do (every tick is interrupted).
+// Compare : CC1 is set to the deadline. A deadline which is already passed
+// makes the CC1 event by software, so it is not missed.
+MOTOR_RAM_FUNC void TimerSchedule( uint32_t deadline )
+{
+#if TIMER_COMPARE_ENABLE
+    TIM_TypeDef* const pTim = s_phTim->Instance;
+    pTim->CCR1 = deadline;
+    if( (int32_t)(pTim->CNT - deadline) >= 0 )  pTim->EGR = TIM_EGR_CC1G;
+#else
+    (void)deadline;
+#endif
+}
+
+// function : Get total cycles of the motion control (for the interrupt load)
+// Motor control and encoder check (CC2 in compare mode) are included.
+// The interrupt entry and exit are not included.
+uint32_t TimerGetCycles( void )
+{
+    return s_ControlCycles;
+}
+
+// function : Timer update interrupt (call from TIM2_IRQHandler, return 1 : handled)
+// Update interrupt is handled without the flag checks of HAL_TIM_IRQHandler()
+// and the instance check of HAL_TIM_PeriodElapsedCallback().
+// Other enabled interrupts (not used) return 0 and go to HAL_TIM_IRQHandler().
+// Compare : CC1 (motors) and CC2 (encoder) are handled here.
+MOTOR_RAM_FUNC uint32_t TimerUpdateIRQHandler( void )
+{
+    TIM_TypeDef* const pTim = s_phTim->Instance;
+    // interrupt flags and enable bits are at the same position (bit0-7)
+    uint32_t pending = pTim->SR & pTim->DIER & 0xFF;
+#if TIMER_COMPARE_ENABLE
+    if( (pending == 0) || ((pending & ~TIMER_COMPARE_IRQ) != 0) )   return 0;
+
+    pTim->SR = ~pending;
+    if( (pending & TIM_SR_CC2IF) != 0 ) TimerEncoder();
+    if( (pending & TIM_SR_CC1IF) != 0 ) TimerControl();
+#else
+    if( pending != TIM_SR_UIF )     return 0;
+
+    pTim->SR = ~TIM_SR_UIF;
+    TimerControl();
+#endif
+    return 1;
+}
+
+#if TIMER_COMPARE_ENABLE
+void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim)
+{
+    if (htim->Instance == s_phTim->Instance) {
+        if (htim->Channel == HAL_TIM_ACTIVE_CHANNEL_2) {
+            TimerEncoder();
+        }
+        if (htim->Channel == HAL_TIM_ACTIVE_CHANNEL_1) {
+            TimerControl();
+        }
+    }
 }
+#endif
 
-void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
+MOTOR_RAM_FUNC void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 {
     if (htim->Instance == s_phTim->Instance) {
-        MotorControl();
+        TimerControl();
     }
 }
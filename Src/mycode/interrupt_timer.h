@@ -1 +1,20 @@
-void TimerInitialize( void );
\ No newline at end of file
+// TIM2 interrupt entry
+// 1 : update interrupt is handled by TimerUpdateIRQHandler() (fast path)
+// 0 : HAL_TIM_IRQHandler() -> HAL_TIM_PeriodElapsedCallback()
+#define TIMER_FAST_IRQ_ENABLE   (1)
+
+// Step timing
+// 0 : periodic tick, TIM2 update interrupt every tick (1ms)
+// 1 : TIM2 is free-running (1 count per tick) and the CC1 interrupt comes at
+//     the earliest deadline of the motors only, so the interrupt count is the
+//     number of updates (steps, count down end) and not ticks.
+//     Encoder check is the CC2 interrupt every TIMER_ENCODER_PERIOD ticks.
+//     B and W serial commands run ticks directly and need the periodic tick.
+#define TIMER_COMPARE_ENABLE    (0)
+#define TIMER_ENCODER_PERIOD    (10)        // ticks
+
+void TimerInitialize( void );
+uint32_t TimerUpdateIRQHandler( void );
+uint32_t TimerGetCycles( void );
+uint32_t TimerGetTick( void );
+void TimerSchedule( uint32_t deadline );
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include "stm32f4xx_hal.h"
+#include "motor_backup.h"
+
+// Backup register layout
+// The RTC backup registers keep their value over a system reset (and over
+// power down while VBAT is supplied), so the position does not need homing
+// after a warm reset.
+//   BKP[n*3+0] : motor position (lower 32bit)
+//   BKP[n*3+1] : motor position (upper 32bit)
+//   BKP[n*3+2] : [31:16] magic, [15:8] check sum, [2:0] phase position
+// Record is written only at the transition to IDLE and is cleared when a
+// move starts, so a reset while running always reads as invalid.
+#define BACKUP_REGISTER_NUM     (20)
+#define BACKUP_REGISTER_PER_MTR (3)
+#define BACKUP_MOTOR_MAX        (BACKUP_REGISTER_NUM / BACKUP_REGISTER_PER_MTR)
+#define BACKUP_MAGIC            (0x5AF0)
+#define BACKUP_PHASE_MASK       (0x00000007)
+
+#define BACKUP_REGISTER(n)      ((&(RTC->BKP0R))[(n)])
+
+// Private functions definition
+static uint32_t MotorBackupCheckSum( int64_t position, uint32_t phase_pos );
+
+// function : Check sum for backup record
+static uint32_t MotorBackupCheckSum( int64_t position, uint32_t phase_pos )
+{
+    uint64_t value = (uint64_t)position;
+    uint32_t sum   = 0xA5;
+
+    for(uint32_t nByte=0; nByte < sizeof(value); nByte++ ){
+        sum += (uint32_t)(value >> (nByte * 8)) & 0xFF;
+    }
+    sum += phase_pos & BACKUP_PHASE_MASK;
+    return sum & 0xFF;
+}
+
+// function : Initialize for backup domain access
+void MotorBackupInitialize( void )
+{
+    // PWR clock is enabled in HAL_MspInit()
+    HAL_PWR_EnableBkUpAccess();
+}
+
+// function : Load backup record ( return 1 : valid record )
+uint32_t MotorBackupLoad( uint16_t nMotor, int64_t* pPosition, uint32_t* pPhasePos )
+{
+    if( nMotor > (BACKUP_MOTOR_MAX - 1) )   return 0;
+
+    uint32_t lower     = BACKUP_REGISTER( nMotor * BACKUP_REGISTER_PER_MTR + 0 );
+    uint32_t upper     = BACKUP_REGISTER( nMotor * BACKUP_REGISTER_PER_MTR + 1 );
+    int64_t  position  = (int64_t)(((uint64_t)upper << 32) | lower);
+    uint32_t info      = BACKUP_REGISTER( nMotor * BACKUP_REGISTER_PER_MTR + 2 );
+    uint32_t phase_pos = info & BACKUP_PHASE_MASK;
+
+    // Check record
+    if( (info >> 16) != BACKUP_MAGIC )  return 0;
+    if( ((info >> 8) & 0xFF) != MotorBackupCheckSum( position, phase_pos ) )   return 0;
+
+    *pPosition = position;
+    *pPhasePos = phase_pos;
+    return 1;
+}
+
+// function : Save backup record
+void MotorBackupSave( uint16_t nMotor, int64_t position, uint32_t phase_pos )
+{
+    if( nMotor > (BACKUP_MOTOR_MAX - 1) )   return;
+
+    phase_pos &= BACKUP_PHASE_MASK;
+    // position first, record becomes valid with the last write
+    BACKUP_REGISTER( nMotor * BACKUP_REGISTER_PER_MTR + 0 ) = (uint32_t)position;
+    BACKUP_REGISTER( nMotor * BACKUP_REGISTER_PER_MTR + 1 ) = (uint32_t)((uint64_t)position >> 32);
+    BACKUP_REGISTER( nMotor * BACKUP_REGISTER_PER_MTR + 2 ) = ((uint32_t)BACKUP_MAGIC << 16)
+                                                            | (MotorBackupCheckSum( position, phase_pos ) << 8)
+                                                            | phase_pos;
+}
+
+// function : Invalidate backup record
+void MotorBackupInvalidate( uint16_t nMotor )
+{
+    if( nMotor > (BACKUP_MOTOR_MAX - 1) )   return;
+
+    BACKUP_REGISTER( nMotor * BACKUP_REGISTER_PER_MTR + 2 ) = 0;
+}
@@ -0,0 +1,5 @@
+// Position backup (RTC backup registers)
+void MotorBackupInitialize( void );
+uint32_t MotorBackupLoad( uint16_t nMotor, int64_t* pPosition, uint32_t* pPhasePos );
+void MotorBackupSave( uint16_t nMotor, int64_t position, uint32_t phase_pos );
+void MotorBackupInvalidate( uint16_t nMotor );
\ No newline at end of file
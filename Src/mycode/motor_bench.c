@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "stepping_motor.h"
+#include "motor_bench.h"
+#include "serial_port.h"
+#include "interrupt_timer.h"
+
+// Benchmark for the timer interrupt path
+// The motion core is run by calling the TIM2 period elapsed callback
+// directly with TIM2 interrupt disabled, and each call is measured with the
+// DWT cycle counter (interrupts are masked during the measurement).
+// The result is sent to the serial port as 1 line of JSON.
+// The header has the flash wait states and MOTOR_RAM_ENABLE, so results of
+// the timer interrupt path in flash and in RAM can be compared.
+// irq_hal / irq_fast measure the TIM2 interrupt entry (update event made by
+// software) through HAL_TIM_IRQHandler() and TimerUpdateIRQHandler() with
+// all motors IDLE; the difference is the saving of the fast path.
+//
+// NOTE : motors really move while the benchmark is running.
+
+#define BENCH_TICKS         (1000)      // ticks per scenario
+#define BENCH_FAR           (100000)    // target position never reached
+#define BENCH_CHAIN_STEPS   (4)         // steps per move in chain scenario
+
+extern TIM_HandleTypeDef	htim2;
+
+// Benchmark result structure
+typedef struct {
+    uint32_t            ticks;                  // measured ticks
+    uint32_t            steps;                  // steps issued
+    uint32_t            cycles_min;             // min cycles per tick
+    uint32_t            cycles_max;             // max cycles per tick
+    uint64_t            cycles_sum;             // total cycles
+    uint64_t            cycles_sum2;            // total cycles^2 (for variance)
+}BENCH_RESULT;
+
+// Benchmark scenario structure
+typedef struct {
+    const char*         name;                   // scenario name
+    void                (*start)( void );       // set up before ticks
+    void                (*tick)( void );        // called between ticks (not measured)
+    void                (*call)( void );        // measured call of 1 tick
+}BENCH_SCENARIO;
+
+// Private functions definition
+static void BenchStartIdle( void );
+static void BenchStartMaxPPS( void );
+static void BenchStartMixed( void );
+static void BenchStartChain( void );
+static void BenchStartRamp( void );
+static void BenchTickChain( void );
+static void BenchTickUpdateEvent( void );
+static void BenchCallCallback( void );
+static void BenchCallIrqHal( void );
+static void BenchCallIrqFast( void );
+static void BenchWaitIdle( void );
+static void BenchRun( const BENCH_SCENARIO* const pScn, BENCH_RESULT* const pRes );
+static void BenchReport( const BENCH_SCENARIO* const pScn, const BENCH_RESULT* const pRes, uint32_t first );
+
+static const BENCH_SCENARIO sc_Scenario[] = {
+    { "idle",       BenchStartIdle,     NULL,                   BenchCallCallback   },   // all motors IDLE
+    { "max_pps",    BenchStartMaxPPS,   NULL,                   BenchCallCallback   },   // motor0 at max PPS
+    { "mixed",      BenchStartMixed,    NULL,                   BenchCallCallback   },   // all motors, different PPS
+    { "chain",      BenchStartChain,    BenchTickChain,         BenchCallCallback   },   // short moves back to back
+    { "ramp",       BenchStartRamp,     NULL,                   BenchCallCallback   },   // motor0 velocity ramp, others geared
+    { "irq_hal",    BenchStartIdle,     BenchTickUpdateEvent,   BenchCallIrqHal     },   // interrupt entry by HAL
+    { "irq_fast",   BenchStartIdle,     BenchTickUpdateEvent,   BenchCallIrqFast    },   // interrupt entry by fast path
+};
+#define BENCH_SCENARIO_NUM  (sizeof(sc_Scenario) / sizeof(sc_Scenario[0]))
+
+// function : Scenario all motors idle
+static void BenchStartIdle( void )
+{
+}
+
+// function : Scenario motor0 at max PPS
+static void BenchStartMaxPPS( void )
+{
+    MotorMove( 0, INTERRUPT_TIMER_INTERVAL, MotorGetPosition( 0 ) + BENCH_FAR );
+}
+
+// function : Scenario all motors with different PPS and direction
+static void BenchStartMixed( void )
+{
+    for(uint16_t nMotor=0; nMotor < MOTOR_MAX; nMotor++ ){
+        int32_t far = (nMotor & 1) ? -BENCH_FAR : BENCH_FAR;
+        MotorMove( nMotor, INTERRUPT_TIMER_INTERVAL >> (nMotor % 4), MotorGetPosition( nMotor ) + far );
+    }
+}
+
+// function : Scenario short moves back to back
+static void BenchStartChain( void )
+{
+    BenchTickChain();
+}
+static void BenchTickChain( void )
+{
+    static int32_t s_Dir = BENCH_CHAIN_STEPS;
+    for(uint16_t nMotor=0; nMotor < MOTOR_MAX; nMotor++ ){
+        if( MotorIsBusy( nMotor ) != 0 )   continue;
+        MotorMove( nMotor, INTERRUPT_TIMER_INTERVAL, MotorGetPosition( nMotor ) + s_Dir );
+    }
+    s_Dir = -s_Dir;
+}
+
+// function : Scenario velocity ramp with all other motors geared to motor0
+static void BenchStartRamp( void )
+{
+    MotorRun( 0, INTERRUPT_TIMER_INTERVAL );
+    for(uint16_t nMotor=1; nMotor < MOTOR_MAX; nMotor++ ){
+        MotorGear( nMotor, 0, 1, 1 );
+    }
+}
+
+// function : Make update event (UIF is set as the timer interrupt)
+static void BenchTickUpdateEvent( void )
+{
+    htim2.Instance->EGR = TIM_EGR_UG;
+}
+
+// function : Measured calls
+static void BenchCallCallback( void )
+{
+    HAL_TIM_PeriodElapsedCallback( &htim2 );
+}
+static void BenchCallIrqHal( void )
+{
+    HAL_TIM_IRQHandler( &htim2 );
+}
+static void BenchCallIrqFast( void )
+{
+    (void)TimerUpdateIRQHandler();
+}
+
+// function : Stop all motors and wait for IDLE
+static void BenchWaitIdle( void )
+{
+    for(uint16_t nMotor=0; nMotor < MOTOR_MAX; nMotor++ ){
+        MotorStop( nMotor );
+        while( MotorIsBusy( nMotor ) != 0 ){
+            HAL_TIM_PeriodElapsedCallback( &htim2 );
+        }
+    }
+}
+
+// function : Run 1 scenario
+static void BenchRun( const BENCH_SCENARIO* const pScn, BENCH_RESULT* const pRes )
+{
+    int64_t position[MOTOR_MAX];
+
+    pRes->ticks       = 0;
+    pRes->steps       = 0;
+    pRes->cycles_min  = 0xFFFFFFFF;
+    pRes->cycles_max  = 0;
+    pRes->cycles_sum  = 0;
+    pRes->cycles_sum2 = 0;
+
+    pScn->start();
+    for(uint32_t nTick=0; nTick < BENCH_TICKS; nTick++ ){
+        if( pScn->tick != NULL )    pScn->tick();
+        for(uint16_t nMotor=0; nMotor < MOTOR_MAX; nMotor++ ){
+            position[nMotor] = MotorGetPosition( nMotor );
+        }
+
+        // Measure
+        __disable_irq();
+        uint32_t start = DWT->CYCCNT;
+        pScn->call();
+        uint32_t cycles = DWT->CYCCNT - start;
+        __enable_irq();
+
+        if( cycles < pRes->cycles_min ) pRes->cycles_min = cycles;
+        if( cycles > pRes->cycles_max ) pRes->cycles_max = cycles;
+        pRes->cycles_sum  += cycles;
+        pRes->cycles_sum2 += (uint64_t)cycles * cycles;
+        pRes->ticks++;
+        for(uint16_t nMotor=0; nMotor < MOTOR_MAX; nMotor++ ){
+            if( MotorGetPosition( nMotor ) != position[nMotor] ) pRes->steps++;
+        }
+    }
+    BenchWaitIdle();
+}
+
+// function : Report 1 scenario (JSON object)
+static void BenchReport( const BENCH_SCENARIO* const pScn, const BENCH_RESULT* const pRes, uint32_t first )
+{
+    char     line[256];
+    uint64_t mean     = pRes->cycles_sum / pRes->ticks;
+    uint64_t variance = (pRes->cycles_sum2 / pRes->ticks) - (mean * mean);
+    uint64_t total_ns = (pRes->cycles_sum * 1000000000ULL) / SystemCoreClock;
+    uint32_t tick_ns  = (uint32_t)(total_ns / pRes->ticks);
+    uint32_t step_ns  = (pRes->steps != 0) ? (uint32_t)(total_ns / pRes->steps) : 0;
+
+    int len = snprintf( line, sizeof(line),
+        "%s{\"name\":\"%s\",\"ticks\":%lu,\"steps\":%lu,\"cycles_min\":%lu,\"cycles_max\":%lu,"
+        "\"cycles_mean\":%lu,\"cycles_var\":%lu,\"ns_per_tick\":%lu,\"ns_per_step\":%lu}",
+        (first != 0) ? "" : ",", pScn->name,
+        (unsigned long)pRes->ticks, (unsigned long)pRes->steps,
+        (unsigned long)pRes->cycles_min, (unsigned long)pRes->cycles_max,
+        (unsigned long)mean, (unsigned long)variance,
+        (unsigned long)tick_ns, (unsigned long)step_ns );
+    SerialWrite( (const uint8_t*)line, (uint16_t)len );
+}
+
+// function : Run all scenarios and send JSON to serial port
+void MotorBenchRun( void )
+{
+    char         line[128];
+    BENCH_RESULT result;
+
+    // DWT cycle counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+
+    // Timer interrupt is replaced by direct call
+    HAL_NVIC_DisableIRQ( TIM2_IRQn );
+    BenchWaitIdle();
+
+    int len = snprintf( line, sizeof(line), "{\"bench\":\"motor_control\",\"core_hz\":%lu,\"flash_latency\":%lu,\"ram_func\":%u,\"motors\":%u,\"results\":[",
+                        (unsigned long)SystemCoreClock, (unsigned long)__HAL_FLASH_GET_LATENCY(),
+                        (unsigned int)MOTOR_RAM_ENABLE, (unsigned int)MOTOR_MAX );
+    SerialWrite( (const uint8_t*)line, (uint16_t)len );
+    for(uint32_t nScn=0; nScn < BENCH_SCENARIO_NUM; nScn++ ){
+        BenchRun( &sc_Scenario[nScn], &result );
+        BenchReport( &sc_Scenario[nScn], &result, (nScn == 0) );
+    }
+    SerialWrite( (const uint8_t*)"]}\r\n", 4 );
+
+    HAL_NVIC_EnableIRQ( TIM2_IRQn );
+}
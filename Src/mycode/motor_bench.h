@@ -0,0 +1 @@
+void MotorBenchRun( void );
\ No newline at end of file
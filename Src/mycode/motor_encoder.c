@@ -0,0 +1,162 @@
+#include "stm32f4xx_hal.h"
+#include "stepping_motor.h"
+#include "motor_encoder.h"
+
+// Step loss detection
+// Commanded position (motor_position) and measured position (encoder) are
+// compared every timer interrupt in encoder counts. When the difference is
+// over the threshold the status becomes ENS_FOLLOWING_ERROR, and with
+// recovery enabled the motor is stopped and motor_position is re-synced to
+// the measured position.
+// The rotor turns without motor_position while backlash is taken up, so the
+// commanded rotor position is motor_position + backlash offset.
+
+// Encoder information structure
+typedef struct {
+    uint32_t            enable;                 // 1 : encoder is used
+    uint32_t            recovery;               // 1 : stop and re-sync on following error
+    TIM_HandleTypeDef*  phTim;                  // encoder mode timer
+    int32_t             counts_per_step;        // encoder counts per motor step
+    int32_t             threshold;              // following error threshold (counts)
+    uint16_t            last_count;             // last timer counter value
+    int64_t             count;                  // accumulated encoder count
+    int64_t             last_command;           // last commanded position (simulation)
+    int64_t             following_error;        // last following error (counts)
+    ENCODER_STATUS      status;                 // encoder status
+}ENCODER_INFO;
+
+extern TIM_HandleTypeDef	htim3;
+
+// Encoder information
+#define ENCODER_MOTOR_MAX   (1)             // the number of motors with encoder
+static ENCODER_INFO     encoders[ENCODER_MOTOR_MAX] = {
+    {   // Motor0 encoder information
+        1,              // enable
+        1,              // recovery
+        &htim3,         // encoder mode timer
+        4,              // counts per step (200line x4 / 200step)
+        8,              // following error threshold (2 steps)
+        0,              // last timer counter value
+        0,              // accumulated encoder count
+        0,              // last commanded position
+        0,              // last following error
+        ENS_OK,         // encoder status
+    },
+};
+
+// Private functions definition
+static void MotorEncoderUpdate( uint16_t nMotor, ENCODER_INFO* const pEnc );
+static void MotorEncoderUpdateCount( uint16_t nMotor, ENCODER_INFO* const pEnc );
+
+// function : Update for Encoder count
+MOTOR_RAM_FUNC static void MotorEncoderUpdateCount( uint16_t nMotor, ENCODER_INFO* const pEnc )
+{
+#if ENCODER_SIMULATION
+    // Rotor follows the command
+    int64_t command = MotorGetPosition( nMotor ) + MotorGetBacklashOffset( nMotor );
+    pEnc->count += (command - pEnc->last_command) * pEnc->counts_per_step;
+    pEnc->last_command = command;
+#else
+    // 16bit counter is extended by the difference
+    uint16_t now = (uint16_t)__HAL_TIM_GET_COUNTER( pEnc->phTim );
+    pEnc->count += (int16_t)(now - pEnc->last_count);
+    pEnc->last_count = now;
+#endif
+}
+
+// function : Update for Encoder check
+MOTOR_RAM_FUNC static void MotorEncoderUpdate( uint16_t nMotor, ENCODER_INFO* const pEnc )
+{
+    if( pEnc->enable == 0 )  return;
+
+    MotorEncoderUpdateCount( nMotor, pEnc );
+
+    // Following error
+    int64_t rotor = MotorGetPosition( nMotor ) + MotorGetBacklashOffset( nMotor );
+    pEnc->following_error = pEnc->count - (rotor * pEnc->counts_per_step);
+    if( (pEnc->following_error <= pEnc->threshold) && (pEnc->following_error >= -pEnc->threshold) ) return;
+    pEnc->status = ENS_FOLLOWING_ERROR;
+
+    // Stall recovery
+    if( pEnc->recovery == 0 )    return;
+    int64_t count    = pEnc->count;
+    int64_t position = count / pEnc->counts_per_step;
+    MotorStop( nMotor );
+    MotorSetPosition( nMotor, position - MotorGetBacklashOffset( nMotor ) );
+    // measured count is kept (MotorSetPosition shifts the encoder position)
+    pEnc->count        = count;
+    pEnc->last_command = position;
+}
+
+// function : Initialize for Encoder
+void MotorEncoderInitialize( void )
+{
+    for(uint16_t nMotor=0; nMotor < ENCODER_MOTOR_MAX; nMotor++ ){
+        ENCODER_INFO* pEnc = &(encoders[nMotor]);
+        if( pEnc->enable == 0 )  continue;
+#if !ENCODER_SIMULATION
+        HAL_TIM_Encoder_Start( pEnc->phTim, TIM_CHANNEL_ALL );
+        pEnc->last_count = (uint16_t)__HAL_TIM_GET_COUNTER( pEnc->phTim );
+#endif
+        // Start from the (restored) commanded position
+        pEnc->last_command = MotorGetPosition( nMotor ) + MotorGetBacklashOffset( nMotor );
+        pEnc->count        = pEnc->last_command * pEnc->counts_per_step;
+        pEnc->status       = ENS_OK;
+    }
+}
+
+// function : Control for Encoder check (call from timer interrupt)
+MOTOR_RAM_FUNC void MotorEncoderControl( void )
+{
+    for(uint16_t nMotor=0; nMotor < ENCODER_MOTOR_MAX; nMotor++ ){
+        MotorEncoderUpdate( nMotor, &(encoders[nMotor]) );
+    }
+}
+
+// function : Get measured position (steps)
+int64_t MotorEncoderGetPosition( uint16_t nMotor )
+{
+    if( nMotor > (ENCODER_MOTOR_MAX - 1) )  return 0;
+
+    return encoders[nMotor].count / encoders[nMotor].counts_per_step;
+}
+
+// function : Set position (coordinate shift with the commanded position)
+void MotorEncoderSetPosition( uint16_t nMotor, int64_t position )
+{
+    if( nMotor > (ENCODER_MOTOR_MAX - 1) )  return;
+
+    ENCODER_INFO* pEnc = &(encoders[nMotor]);
+    pEnc->count       += (position - MotorGetPosition( nMotor )) * pEnc->counts_per_step;
+    pEnc->last_command = position + MotorGetBacklashOffset( nMotor );
+}
+
+// function : Get Encoder status
+ENCODER_STATUS MotorEncoderStatus( uint16_t nMotor )
+{
+    if( nMotor > (ENCODER_MOTOR_MAX - 1) )  return ENS_OK;
+
+    return encoders[nMotor].status;
+}
+
+// function : Clear following error
+void MotorEncoderClearError( uint16_t nMotor )
+{
+    if( nMotor > (ENCODER_MOTOR_MAX - 1) )  return;
+
+    encoders[nMotor].status = ENS_OK;
+}
+
+#if ENCODER_SIMULATION
+// function : Inject step loss (simulation)
+void MotorEncoderInjectLoss( uint16_t nMotor, int32_t steps )
+{
+    uint32_t primask;
+    if( nMotor > (ENCODER_MOTOR_MAX - 1) )  return;
+
+    // Rotor slips against the direction of the command
+    MOTOR_DISABLE_INTERRUPT( primask );
+    encoders[nMotor].count -= steps * encoders[nMotor].counts_per_step;
+    MOTOR_ENABLE_INTERRUPT( primask );
+}
+#endif
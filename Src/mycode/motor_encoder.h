@@ -0,0 +1,20 @@
+// Encoder simulation
+// 1 : encoder count is made from the commanded position (no encoder wired)
+// 0 : encoder count is read from TIM3 (encoder mode)
+#define ENCODER_SIMULATION      (1)
+
+// Encoder Status
+typedef enum {
+    ENS_OK          = 0,    // following
+    ENS_FOLLOWING_ERROR,    // following error over threshold
+}ENCODER_STATUS;
+
+void MotorEncoderInitialize( void );
+void MotorEncoderControl( void );
+int64_t MotorEncoderGetPosition( uint16_t nMotor );
+void MotorEncoderSetPosition( uint16_t nMotor, int64_t position );
+ENCODER_STATUS MotorEncoderStatus( uint16_t nMotor );
+void MotorEncoderClearError( uint16_t nMotor );
+#if ENCODER_SIMULATION
+void MotorEncoderInjectLoss( uint16_t nMotor, int32_t steps );
+#endif
\ No newline at end of file
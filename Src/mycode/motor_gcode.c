@@ -0,0 +1,407 @@
+#include "stm32f4xx_hal.h"
+#include "stepping_motor.h"
+#include "motor_home.h"
+#include "motor_gcode.h"
+#include "gcode_parser.h"
+#include "serial_port.h"
+
+// G-code interpreter (streaming from the serial port)
+// Lines are executed one by one and answered with "ok" or "error".
+// The sender must wait for the answer before sending the next line. A move
+// that does not fit in the segment queues (MotorQueueMove()) is kept and
+// executed again when a segment is taken, so the answer is delayed until
+// the move is queued.
+//
+//   G0 / G1 X Y F : rapid (GCODE_RAPID_PPS) / feed move, F is mm/min (modal)
+//   G4 P / S      : dwell ms / s after the queued moves
+//   G28 X Y       : home (LIMIT0) or move to 0 for axes without limit switch
+//   G90 / G91     : absolute / relative positions
+//   G21           : mm (the only unit, accepted for compatibility)
+//   M17 / M18     : enable / disable motors after the queued moves
+//
+// Positions are kept in 0.001 mm and converted to steps with steps/mm of
+// each axis, so rounding errors are not accumulated. Axes of a G1 move get
+// PPS of the same move time, but each axis runs its own segment queue (no
+// interpolation between axes). Moves on the same axes are queued back to
+// back; a move on other axes waits until all axes are IDLE, so the axes of
+// a move start together (at the same tick by MotorArm / MotorFire).
+
+#define GCODE_LINE_MAX      (96)        // characters per line
+#define GCODE_RAPID_PPS     (INTERRUPT_TIMER_INTERVAL)  // PPS of G0
+#define GCODE_DEFAULT_FEED  (600 * GCODE_SCALE)         // mm/min x GCODE_SCALE
+
+// Interpreter status
+typedef enum {
+    GCS_READY       = 0,    // next line is accepted
+    GCS_WAIT_IDLE,          // waiting for all axes IDLE (then the action)
+    GCS_DWELL,              // dwell (G4)
+    GCS_HOME,               // homing (G28)
+    GCS_MAX,                // the number of status
+}GCODE_STATUS;
+
+// Action after the queued moves
+typedef enum {
+    GCA_NONE        = 0,    // no action
+    GCA_DWELL,              // G4
+    GCA_HOME,               // G28
+    GCA_DISABLE,            // M18
+    GCA_MAX,                // the number of actions
+}GCODE_ACTION;
+
+// Axis information structure
+typedef struct {
+    char                letter;                 // axis letter
+    uint16_t            motor;                  // motor number
+    int32_t             steps_per_mm;           // steps per mm x GCODE_SCALE
+    int32_t             position;               // commanded position (x GCODE_SCALE mm)
+}GCODE_AXIS;
+
+// Interpreter information structure
+typedef struct {
+    GCODE_STATUS        status;                 // interpreter status
+    GCODE_ACTION        action;                 // action after the queued moves
+    uint32_t            absolute;               // 1 : G90 / 0 : G91
+    uint32_t            enable;                 // 1 : motors are enabled (M17)
+    uint32_t            motion;                 // modal motion (0 : G0 / 1 : G1)
+    int32_t             feed;                   // feed rate (mm/min x GCODE_SCALE)
+    uint32_t            dwell;                  // dwell time (ms)
+    uint32_t            dwell_start;            // dwell start (HAL tick)
+    uint32_t            home_mask;              // homing axes (bit)
+    uint32_t            move_mask;              // axes of the last move (bit)
+    uint32_t            pending;                // 1 : line waits for the motion queue
+    uint32_t            length;                 // line length
+    uint32_t            overflow;               // 1 : line is too long
+    char                line[GCODE_LINE_MAX];   // line buffer
+}GCODE_INFO;
+
+// Axis information
+static GCODE_AXIS       axes[] = {
+    {   'X',    0,  25 * GCODE_SCALE,   0   },  // 200 steps/rev, 8mm lead
+    {   'Y',    1,  25 * GCODE_SCALE,   0   },  // 200 steps/rev, 8mm lead
+};
+#define GCODE_AXIS_MAX  (sizeof(axes) / sizeof(axes[0]))
+
+static GCODE_INFO       s_Gcode;
+
+// Private functions definition
+static int64_t GcodeToSteps( const GCODE_AXIS* const pAxis, int32_t position );
+static uint32_t GcodeSqrt( uint64_t value );
+static uint32_t GcodeIsIdle( void );
+static void GcodeUpdate( void );
+static GCODE_RESULT GcodeMove( const GCODE_BLOCK* const pBlock, uint32_t motion, uint32_t absolute );
+static GCODE_RESULT GcodeExecute( const char* pLine, uint32_t length );
+static void GcodeAnswer( GCODE_RESULT result );
+
+// function : Position (x GCODE_SCALE mm) to steps (rounded)
+static int64_t GcodeToSteps( const GCODE_AXIS* const pAxis, int32_t position )
+{
+    int64_t value = (int64_t)position * pAxis->steps_per_mm;
+    int64_t half  = (int64_t)GCODE_SCALE * GCODE_SCALE / 2;
+    return (value + ((value < 0) ? -half : half)) / ((int64_t)GCODE_SCALE * GCODE_SCALE);
+}
+
+// function : Integer square root
+static uint32_t GcodeSqrt( uint64_t value )
+{
+    uint64_t root = 0;
+    uint64_t bit  = (uint64_t)1 << 62;
+    while( bit > value )    bit >>= 2;
+    while( bit != 0 ){
+        if( value >= root + bit ){
+            value -= root + bit;
+            root   = (root >> 1) + bit;
+        }
+        else{
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)root;
+}
+
+// function : All axes are IDLE and no move is queued ( return 1 : idle )
+static uint32_t GcodeIsIdle( void )
+{
+    for(uint16_t nAxis=0; nAxis < GCODE_AXIS_MAX; nAxis++ ){
+        if( MotorIsBusy( axes[nAxis].motor ) != 0 )         return 0;
+        if( MotorQueueDepth( axes[nAxis].motor ) != 0 )     return 0;
+    }
+    return 1;
+}
+
+// function : Update for waiting status
+static void GcodeUpdate( void )
+{
+    GCODE_INFO* pGcode = &s_Gcode;
+
+    switch( pGcode->status ){
+        default:
+        case GCS_READY:
+            break;
+        case GCS_WAIT_IDLE:
+            if( GcodeIsIdle() == 0 )    break;
+            pGcode->status = GCS_READY;
+            if( pGcode->action == GCA_DWELL ){
+                pGcode->dwell_start = HAL_GetTick();
+                pGcode->status      = GCS_DWELL;
+            }
+            else if( pGcode->action == GCA_HOME ){
+                for(uint16_t nAxis=0; nAxis < GCODE_AXIS_MAX; nAxis++ ){
+                    GCODE_AXIS* pAxis = &(axes[nAxis]);
+                    if( ((pGcode->home_mask >> nAxis) & 1) == 0 )  continue;
+                    MotorHome( pAxis->motor );
+                    // No limit switch : move to 0
+                    if( MotorHomeStatus( pAxis->motor ) != HMS_FAST )  MotorMove( pAxis->motor, GCODE_RAPID_PPS, 0 );
+                    pAxis->position = 0;
+                }
+                pGcode->status = GCS_HOME;
+            }
+            else if( pGcode->action == GCA_DISABLE ){
+                pGcode->enable = 0;
+            }
+            pGcode->action = GCA_NONE;
+            break;
+        case GCS_DWELL:
+            if( (HAL_GetTick() - pGcode->dwell_start) >= pGcode->dwell )   pGcode->status = GCS_READY;
+            break;
+        case GCS_HOME:
+            for(uint16_t nAxis=0; nAxis < GCODE_AXIS_MAX; nAxis++ ){
+                HOME_STATUS home = MotorHomeStatus( axes[nAxis].motor );
+                if( (home == HMS_FAST) || (home == HMS_BACK_OFF) || (home == HMS_SLOW) )   return;
+            }
+            if( GcodeIsIdle() != 0 )    pGcode->status = GCS_READY;
+            break;
+    }
+}
+
+// function : G0 / G1 move ( return GCR_BUSY : segment queue is full )
+static GCODE_RESULT GcodeMove( const GCODE_BLOCK* const pBlock, uint32_t motion, uint32_t absolute )
+{
+    GCODE_INFO* pGcode = &s_Gcode;
+    int32_t  target[GCODE_AXIS_MAX];
+    int64_t  steps[GCODE_AXIS_MAX];
+    uint64_t length2 = 0;
+    uint32_t mask    = 0;
+
+    int32_t feed = GCODE_HAS_WORD( pBlock, 'F' ) ? GCODE_WORD( pBlock, 'F' ) : pGcode->feed;
+    if( (motion != 0) && (feed <= 0) )  return GCR_ERROR;
+
+    // Targets
+    for(uint16_t nAxis=0; nAxis < GCODE_AXIS_MAX; nAxis++ ){
+        GCODE_AXIS* pAxis = &(axes[nAxis]);
+        target[nAxis] = pAxis->position;
+        if( GCODE_HAS_WORD( pBlock, pAxis->letter ) ){
+            int32_t value = GCODE_WORD( pBlock, pAxis->letter );
+            target[nAxis] = (absolute != 0) ? value : (pAxis->position + value);
+        }
+        int64_t delta = (int64_t)target[nAxis] - pAxis->position;
+        steps[nAxis]  = GcodeToSteps( pAxis, target[nAxis] ) - GcodeToSteps( pAxis, pAxis->position );
+        length2      += (uint64_t)(delta * delta);
+        if( steps[nAxis] != 0 )     mask |= (uint32_t)1 << nAxis;
+        // Queue space of the moving axes
+        if( (steps[nAxis] != 0) && (MotorQueueDepth( pAxis->motor ) >= MOTOR_QUEUE_SIZE) )  return GCR_BUSY;
+    }
+    if( (length2 != 0) && (pGcode->enable == 0) )   return GCR_ERROR;
+    if( (mask != 0) && (mask != pGcode->move_mask) && (GcodeIsIdle() == 0) )    return GCR_BUSY;
+
+    // Axes from IDLE start at the same tick (MotorFire)
+    uint32_t idle   = GcodeIsIdle();
+    uint32_t fire   = 0;
+
+    // Same move time for all axes : pps = steps * feed / (length * 60)
+    uint32_t length = GcodeSqrt( length2 );
+    for(uint16_t nAxis=0; nAxis < GCODE_AXIS_MAX; nAxis++ ){
+        GCODE_AXIS* pAxis = &(axes[nAxis]);
+        if( steps[nAxis] != 0 ){
+            uint64_t pps = GCODE_RAPID_PPS;
+            if( motion != 0 ){
+                uint64_t count = (uint64_t)((steps[nAxis] < 0) ? -steps[nAxis] : steps[nAxis]);
+                uint64_t den   = (uint64_t)length * 60;
+                pps = ((count * (uint64_t)feed) + den - 1) / den;
+                if( pps > GCODE_RAPID_PPS ) pps = GCODE_RAPID_PPS;
+            }
+            if( idle != 0 ){
+                MotorArm( pAxis->motor, (uint32_t)pps, GcodeToSteps( pAxis, target[nAxis] ) );
+                fire |= (uint32_t)1 << pAxis->motor;
+            }
+            else{
+                MotorQueueMove( pAxis->motor, (uint32_t)pps, GcodeToSteps( pAxis, target[nAxis] ) );
+            }
+        }
+        pAxis->position = target[nAxis];
+    }
+    if( fire != 0 )     MotorFire( fire );
+    if( mask != 0 )     pGcode->move_mask = mask;
+    pGcode->feed = feed;
+    return GCR_OK;
+}
+
+// function : Execute 1 line
+static GCODE_RESULT GcodeExecute( const char* pLine, uint32_t length )
+{
+    GCODE_INFO* pGcode = &s_Gcode;
+    GCODE_BLOCK block;
+
+    GCODE_PARSE parse = GcodeParse( pLine, length, &block );
+    if( parse == GCP_EMPTY )    return GCR_OK;
+    if( parse != GCP_OK )       return GCR_ERROR;
+
+    // G words (modal codes and 1 command)
+    uint32_t absolute = pGcode->absolute;
+    uint32_t motion   = pGcode->motion;
+    int32_t  command  = -1;
+    for(uint32_t nWord=0; nWord < block.g_count; nWord++ ){
+        int32_t code = block.g[nWord];
+        switch( code ){
+            default:
+                return GCR_ERROR;
+            case 0 * GCODE_SCALE:
+            case 1 * GCODE_SCALE:
+                motion = (code != 0) ? 1 : 0;
+                // fall through
+            case 4 * GCODE_SCALE:
+            case 28 * GCODE_SCALE:
+                if( command >= 0 )  return GCR_ERROR;
+                command = code;
+                break;
+            case 21 * GCODE_SCALE:
+                break;
+            case 90 * GCODE_SCALE:
+                absolute = 1;
+                break;
+            case 91 * GCODE_SCALE:
+                absolute = 0;
+                break;
+        }
+    }
+    // M word
+    int32_t mcode = GCODE_HAS_WORD( &block, 'M' ) ? GCODE_WORD( &block, 'M' ) : -1;
+    if( (mcode >= 0) && (mcode != 17 * GCODE_SCALE) && (mcode != 18 * GCODE_SCALE) )   return GCR_ERROR;
+    if( (mcode >= 0) && (command >= 0) )    return GCR_ERROR;
+
+    // Axis words without G word : modal motion
+    uint32_t axis_words = 0;
+    for(uint16_t nAxis=0; nAxis < GCODE_AXIS_MAX; nAxis++ ){
+        axis_words |= GCODE_HAS_WORD( &block, axes[nAxis].letter );
+    }
+    if( (command < 0) && (axis_words != 0) )    command = (int32_t)motion * GCODE_SCALE;
+
+    switch( command ){
+        default:
+            break;
+        case 0 * GCODE_SCALE:
+        case 1 * GCODE_SCALE: {
+            GCODE_RESULT result = GcodeMove( &block, motion, absolute );
+            if( result != GCR_OK )  return result;
+            break;
+        }
+        case 4 * GCODE_SCALE: {
+            int32_t dwell = 0;
+            if( GCODE_HAS_WORD( &block, 'P' ) )         dwell = GCODE_WORD( &block, 'P' ) / GCODE_SCALE;
+            else if( GCODE_HAS_WORD( &block, 'S' ) )    dwell = GCODE_WORD( &block, 'S' );
+            if( dwell < 0 )     return GCR_ERROR;
+            pGcode->dwell  = (uint32_t)dwell;
+            pGcode->action = GCA_DWELL;
+            pGcode->status = GCS_WAIT_IDLE;
+            break;
+        }
+        case 28 * GCODE_SCALE:
+            // All axes without axis words
+            pGcode->home_mask = 0;
+            for(uint16_t nAxis=0; nAxis < GCODE_AXIS_MAX; nAxis++ ){
+                if( (axis_words == 0) || GCODE_HAS_WORD( &block, axes[nAxis].letter ) )    pGcode->home_mask |= (uint32_t)1 << nAxis;
+            }
+            pGcode->action = GCA_HOME;
+            pGcode->status = GCS_WAIT_IDLE;
+            break;
+    }
+    if( mcode == 17 * GCODE_SCALE ){
+        pGcode->enable = 1;
+    }
+    if( mcode == 18 * GCODE_SCALE ){
+        pGcode->action = GCA_DISABLE;
+        pGcode->status = GCS_WAIT_IDLE;
+    }
+
+    // Modal codes are changed when the line is executed
+    pGcode->absolute = absolute;
+    pGcode->motion   = motion;
+    return GCR_OK;
+}
+
+// function : Answer to the sender
+static void GcodeAnswer( GCODE_RESULT result )
+{
+    if( result == GCR_OK )  SerialWrite( (const uint8_t*)"ok\r\n", 4 );
+    else                    SerialWrite( (const uint8_t*)"error\r\n", 7 );
+}
+
+// function : Initialize for G-code interpreter
+void MotorGcodeInitialize( void )
+{
+    GCODE_INFO* pGcode = &s_Gcode;
+    pGcode->status   = GCS_READY;
+    pGcode->action   = GCA_NONE;
+    pGcode->absolute = 1;
+    pGcode->enable   = 1;
+    pGcode->motion   = 0;
+    pGcode->feed     = GCODE_DEFAULT_FEED;
+    pGcode->move_mask = 0;
+    pGcode->pending  = 0;
+    pGcode->length   = 0;
+    pGcode->overflow = 0;
+
+    // Start from the (restored) motor positions
+    for(uint16_t nAxis=0; nAxis < GCODE_AXIS_MAX; nAxis++ ){
+        GCODE_AXIS* pAxis = &(axes[nAxis]);
+        pAxis->position = (int32_t)((MotorGetPosition( pAxis->motor ) * GCODE_SCALE * GCODE_SCALE) / pAxis->steps_per_mm);
+    }
+}
+
+// function : Ready for the next input ( return 1 : ready )
+// A pending line is executed again here.
+uint32_t MotorGcodeReady( void )
+{
+    GCODE_INFO* pGcode = &s_Gcode;
+
+    GcodeUpdate();
+    if( pGcode->pending == 0 )  return 1;
+    if( pGcode->status != GCS_READY )   return 0;
+
+    GCODE_RESULT result = GcodeExecute( pGcode->line, pGcode->length );
+    if( result == GCR_BUSY )    return 0;
+    GcodeAnswer( result );
+    pGcode->pending = 0;
+    pGcode->length  = 0;
+    return 1;
+}
+
+// function : Input 1 character (execute at the line end)
+void MotorGcodeInput( uint8_t data )
+{
+    GCODE_INFO* pGcode = &s_Gcode;
+    if( pGcode->pending != 0 )  return;
+
+    if( (data != '\r') && (data != '\n') ){
+        if( pGcode->length < GCODE_LINE_MAX )   pGcode->line[pGcode->length++] = (char)data;
+        else                                    pGcode->overflow = 1;
+        return;
+    }
+    // Empty line (also the 2nd character of CR LF)
+    if( (pGcode->length == 0) && (pGcode->overflow == 0) )  return;
+
+    if( pGcode->overflow != 0 ){
+        pGcode->overflow = 0;
+        pGcode->length   = 0;
+        GcodeAnswer( GCR_ERROR );
+        return;
+    }
+    pGcode->pending = 1;
+    (void)MotorGcodeReady();
+}
+
+// function : Characters in the line buffer
+uint32_t MotorGcodeLength( void )
+{
+    return s_Gcode.length;
+}
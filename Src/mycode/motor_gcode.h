@@ -0,0 +1,12 @@
+// Result of 1 line
+typedef enum {
+    GCR_OK          = 0,    // executed (or queued)
+    GCR_BUSY,               // motion queue is full (executed again later)
+    GCR_ERROR,              // syntax error, unsupported code
+    GCR_MAX,                // the number of results
+}GCODE_RESULT;
+
+void MotorGcodeInitialize( void );
+uint32_t MotorGcodeReady( void );
+void MotorGcodeInput( uint8_t data );
+uint32_t MotorGcodeLength( void );
\ No newline at end of file
@@ -0,0 +1,150 @@
+#include "stm32f4xx_hal.h"
+#include "main.h"
+#include "stepping_motor.h"
+#include "motor_home.h"
+#include "input_port.h"
+
+// Homing sequence
+//   FAST     : move to the limit switch at fast_pps (CCW)
+//   BACK_OFF : move back_off steps away from the latched edge
+//   SLOW     : move to the limit switch again at slow_pps
+//   DONE     : the position latched at the slow edge becomes 0
+// The motor is stopped and the position is latched in the EXTI callback of
+// the limit switch (first active edge, no debounce wait), so the latch is
+// the step count at the edge. Bounce after the first edge is ignored
+// because the edge is latched once per approach.
+// EXTI0 has the same priority as TIM2, so no step is made between the latch
+// and the stop. In HALF-STEP the stop may complete a half step after the
+// latch; it is counted, so the origin is not moved.
+// The switch must be released (debounced, input_port.c) after BACK_OFF,
+// otherwise SLOW has no edge to latch.
+
+// Homing information structure
+typedef struct {
+    HOME_STATUS         status;                 // homing status
+    uint32_t            fast_pps;               // PPS for fast approach and back off
+    uint32_t            slow_pps;               // PPS for slow approach
+    int32_t             back_off;               // back off steps from the limit switch
+    int32_t             max_travel;             // steps to give up searching
+    GPIO_TypeDef*       limit_port;             // limit switch GPIO PORT NUMBER (EXTI)
+    uint16_t            limit_pin;              // limit switch GPIO PIN NUMBER (active low)
+    uint16_t            limit_input;            // limit switch input number (INPUT_ID)
+    volatile uint32_t   latched;                // limit switch edge latched
+    volatile int64_t    latch_position;         // motor position at the edge
+}HOME_INFO;
+
+// Homing information
+#define HOME_MOTOR_MAX  (1)             // the number of motors with limit switch
+static HOME_INFO        homes[HOME_MOTOR_MAX] = {
+    {   // Motor0 homing information
+        HMS_IDLE,       // homing status
+        500,            // PPS for fast approach
+        50,             // PPS for slow approach
+        20,             // back off steps
+        10000,          // max travel
+        LIMIT0_GPIO_Port,   // limit switch port
+        LIMIT0_Pin,     // limit switch pin
+        INP_LIMIT0,     // limit switch input
+        0,              // latched
+        0,              // latch position
+    },
+};
+
+// Private functions definition
+static void MotorHomeUpdate( uint16_t nMotor, HOME_INFO* const pHome );
+
+// function : Update for Homing sequence
+static void MotorHomeUpdate( uint16_t nMotor, HOME_INFO* const pHome )
+{
+    if( MotorIsBusy( nMotor ) != 0 )   return;
+
+    switch( pHome->status ){
+        default:
+        case HMS_IDLE:
+        case HMS_DONE:
+        case HMS_ERROR:
+            break;
+        case HMS_FAST:
+            if( pHome->latched == 0 ){
+                pHome->status = HMS_ERROR;
+                break;
+            }
+            MotorMove( nMotor, pHome->fast_pps, pHome->latch_position + pHome->back_off );
+            pHome->status = HMS_BACK_OFF;
+            break;
+        case HMS_BACK_OFF:
+            if( InputIsActive( pHome->limit_input ) != 0 ){
+                // back off steps are too short
+                pHome->status = HMS_ERROR;
+                break;
+            }
+            pHome->latched = 0;
+            pHome->status  = HMS_SLOW;
+            MotorMove( nMotor, pHome->slow_pps, MotorGetPosition( nMotor ) - (pHome->back_off * 2) );
+            break;
+        case HMS_SLOW:
+            if( pHome->latched == 0 ){
+                pHome->status = HMS_ERROR;
+                break;
+            }
+            // Limit switch edge is the origin
+            MotorSetPosition( nMotor, MotorGetPosition( nMotor ) - pHome->latch_position );
+            pHome->status = HMS_DONE;
+            break;
+    }
+}
+
+// function : Start Homing
+void MotorHome( uint16_t nMotor )
+{
+    if( nMotor > (HOME_MOTOR_MAX - 1) ) return;
+
+    if( MotorIsBusy( nMotor ) != 0 )    return;
+
+    HOME_INFO* pHome = &(homes[nMotor]);
+    pHome->latched = 0;
+    pHome->status  = HMS_FAST;
+    MotorMove( nMotor, pHome->fast_pps, MotorGetPosition( nMotor ) - pHome->max_travel );
+}
+
+// function : Homing sequence (call from main loop)
+void MotorHomeProcess( void )
+{
+    for(uint16_t nMotor=0; nMotor < HOME_MOTOR_MAX; nMotor++ ){
+        MotorHomeUpdate( nMotor, &(homes[nMotor]) );
+    }
+}
+
+// function : Limit switch edge (call from EXTI callback)
+void MotorHomeExti( uint16_t GPIO_Pin )
+{
+    for(uint16_t nMotor=0; nMotor < HOME_MOTOR_MAX; nMotor++ ){
+        HOME_INFO* pHome = &(homes[nMotor]);
+        if( pHome->limit_pin != GPIO_Pin )  continue;
+        // press edge only (active low)
+        if( HAL_GPIO_ReadPin( pHome->limit_port, pHome->limit_pin ) != GPIO_PIN_RESET )  continue;
+        MotorHomeLimitSwitch( nMotor );
+    }
+}
+
+// function : Limit switch press (latch the position and stop, EXTI context)
+void MotorHomeLimitSwitch( uint16_t nMotor )
+{
+    if( nMotor > (HOME_MOTOR_MAX - 1) ) return;
+
+    HOME_INFO* pHome = &(homes[nMotor]);
+    if( (pHome->status != HMS_FAST) && (pHome->status != HMS_SLOW) )  return;
+    if( pHome->latched != 0 )   return;
+
+    pHome->latch_position = MotorGetPosition( nMotor );
+    pHome->latched        = 1;
+    MotorStop( nMotor );
+}
+
+// function : Get Homing status
+HOME_STATUS MotorHomeStatus( uint16_t nMotor )
+{
+    if( nMotor > (HOME_MOTOR_MAX - 1) ) return HMS_IDLE;
+
+    return homes[nMotor].status;
+}
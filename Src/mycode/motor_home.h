@@ -0,0 +1,15 @@
+// Homing Status
+typedef enum {
+    HMS_IDLE        = 0,    // not homed
+    HMS_FAST,               // fast approach to limit switch
+    HMS_BACK_OFF,           // back off from limit switch
+    HMS_SLOW,               // slow approach to limit switch
+    HMS_DONE,               // homed
+    HMS_ERROR,              // limit switch not found
+}HOME_STATUS;
+
+void MotorHome( uint16_t nMotor );
+void MotorHomeProcess( void );
+void MotorHomeExti( uint16_t GPIO_Pin );
+void MotorHomeLimitSwitch( uint16_t nMotor );
+HOME_STATUS MotorHomeStatus( uint16_t nMotor );
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "stm32f4xx_hal.h"
+#include "stepping_motor.h"
+#include "motor_pvt.h"
+#include "serial_port.h"
+
+// PVT table upload
+// The 'P' serial command is followed by a binary frame, and the table is
+// loaded with MotorPvtLoad() (the slot which is not running).
+//
+// Frame format (little endian)
+//   header : motor(u8), flags(u8, bit0 : repeat, bit1 : start), point count(u16)
+//   point  : position change(i16, steps), velocity(i16, signed PPS), time(u16, ms)
+//   crc    : CRC-16/CCITT-FALSE of the bytes before (u16)
+// The answer is "ok" or "error" (invalid frame, CRC, the other slot is still
+// waiting). With the start flag a stopped motor starts the table, a running
+// table switches to it at the end of its cycle.
+#define PVT_HEADER_SIZE     (4)
+#define PVT_POINT_SIZE      (6)
+#define PVT_CRC_SIZE        (2)
+#define PVT_FRAME_MAX       (PVT_HEADER_SIZE + (PVT_POINT_SIZE * MOTOR_PVT_POINT_MAX) + PVT_CRC_SIZE)
+#define PVT_TIMEOUT         (500)       // ms between bytes (frame is discarded)
+
+#define PVT_FLAG_REPEAT     (0x01)
+#define PVT_FLAG_START      (0x02)
+
+static uint8_t          s_Frame[PVT_FRAME_MAX];
+static MOTOR_PVT_POINT  s_Point[MOTOR_PVT_POINT_MAX];
+static uint32_t         s_Active = 0;   // 1 : receiving a frame
+static uint32_t         s_Length = 0;   // received bytes
+static uint32_t         s_Size   = 0;   // frame size (0 : header is not received)
+static uint32_t         s_LastTick = 0; // last byte (HAL tick)
+
+// Private functions definition
+static uint16_t MotorPvtRead16( const uint8_t* pData );
+static uint32_t MotorPvtExecute( void );
+static void MotorPvtAnswer( uint32_t result );
+
+// function : Little endian 16bit
+static uint16_t MotorPvtRead16( const uint8_t* pData )
+{
+    return (uint16_t)(pData[0] | ((uint16_t)pData[1] << 8));
+}
+
+// function : Answer of frame
+static void MotorPvtAnswer( uint32_t result )
+{
+    if( result != 0 )   SerialWrite( (const uint8_t*)"ok\r\n", 4 );
+    else                SerialWrite( (const uint8_t*)"error\r\n", 7 );
+}
+
+// function : Load (and start) received frame ( return 0 : error )
+static uint32_t MotorPvtExecute( void )
+{
+    uint16_t count = MotorPvtRead16( &s_Frame[2] );
+    uint16_t crc   = MotorPvtRead16( &s_Frame[s_Size - PVT_CRC_SIZE] );
+    if( crc != SerialCrc16( s_Frame, s_Size - PVT_CRC_SIZE ) )  return 0;
+
+    for(uint16_t nPoint=0; nPoint < count; nPoint++ ){
+        const uint8_t* pData = &s_Frame[PVT_HEADER_SIZE + (PVT_POINT_SIZE * nPoint)];
+        s_Point[nPoint].position = (int16_t)MotorPvtRead16( &pData[0] );
+        s_Point[nPoint].velocity = (int16_t)MotorPvtRead16( &pData[2] );
+        s_Point[nPoint].time     = MotorPvtRead16( &pData[4] );
+    }
+    uint16_t nMotor = s_Frame[0];
+    uint8_t  flags  = s_Frame[1];
+    if( MotorPvtLoad( nMotor, s_Point, count, ((flags & PVT_FLAG_REPEAT) != 0) ? 1 : 0 ) == 0 )  return 0;
+    if( (flags & PVT_FLAG_START) != 0 ) MotorPvtStart( nMotor );
+    return 1;
+}
+
+// function : Start receiving a frame ('P' command)
+void MotorPvtUploadBegin( void )
+{
+    s_Active   = 1;
+    s_Length   = 0;
+    s_Size     = 0;
+    s_LastTick = HAL_GetTick();
+}
+
+// function : Receiving a frame ( return 1 : receiving, 0 : not receiving or timeout )
+uint32_t MotorPvtUploadActive( void )
+{
+    if( s_Active == 0 ) return 0;
+
+    if( (HAL_GetTick() - s_LastTick) > PVT_TIMEOUT ){
+        s_Active = 0;
+        MotorPvtAnswer( 0 );
+    }
+    return s_Active;
+}
+
+// function : Input 1 byte of the frame
+void MotorPvtUploadInput( uint8_t data )
+{
+    if( s_Active == 0 ) return;
+
+    s_LastTick = HAL_GetTick();
+    s_Frame[s_Length++] = data;
+    if( (s_Size == 0) && (s_Length == PVT_HEADER_SIZE) ){
+        uint16_t count = MotorPvtRead16( &s_Frame[2] );
+        if( (count == 0) || (count > MOTOR_PVT_POINT_MAX) ){
+            s_Active = 0;
+            MotorPvtAnswer( 0 );
+            return;
+        }
+        s_Size = PVT_HEADER_SIZE + (PVT_POINT_SIZE * count) + PVT_CRC_SIZE;
+    }
+    if( (s_Size != 0) && (s_Length == s_Size) ){
+        s_Active = 0;
+        MotorPvtAnswer( MotorPvtExecute() );
+    }
+}
@@ -0,0 +1,3 @@
+void MotorPvtUploadBegin( void );
+uint32_t MotorPvtUploadActive( void );
+void MotorPvtUploadInput( uint8_t data );
\ No newline at end of file
@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "stepping_motor.h"
+#include "motor_stats.h"
+#include "serial_port.h"
+
+// Motor statistics report
+// The counters of each motor (MotorGetStats) are sent as 1 line of JSON :
+//   {"motors":[{"steps":..,"moves":..,"ticks":[idle,accel,const,decel,break],"queue_max":..,"reversals":..},..]}
+// Ticks are of the timer interrupt (1 ms), so the sum is the time since the reset.
+
+// function : Send statistics of all motors to serial port (JSON)
+void MotorStatsReport( void )
+{
+    char        line[160];
+    MOTOR_STATS stats;
+    SerialWrite( (const uint8_t*)"{\"motors\":[", 11 );
+    for(uint16_t nMotor=0; nMotor < MOTOR_MAX; nMotor++ ){
+        MotorGetStats( nMotor, &stats );
+        int len = snprintf( line, sizeof(line), "%s{\"steps\":%lu,\"moves\":%lu,\"ticks\":[%lu,%lu,%lu,%lu,%lu],\"queue_max\":%lu,\"reversals\":%lu}",
+                            (nMotor == 0) ? "" : ",", (unsigned long)stats.steps, (unsigned long)stats.moves,
+                            (unsigned long)stats.ticks[0], (unsigned long)stats.ticks[1], (unsigned long)stats.ticks[2],
+                            (unsigned long)stats.ticks[3], (unsigned long)stats.ticks[4],
+                            (unsigned long)stats.queue_max, (unsigned long)stats.reversals );
+        SerialWrite( (const uint8_t*)line, (uint16_t)len );
+    }
+    SerialWrite( (const uint8_t*)"]}\r\n", 4 );
+}
+
+// function : Reset statistics of all motors
+void MotorStatsReset( void )
+{
+    for(uint16_t nMotor=0; nMotor < MOTOR_MAX; nMotor++ ){
+        MotorResetStats( nMotor );
+    }
+}
@@ -0,0 +1,2 @@
+void MotorStatsReport( void );
+void MotorStatsReset( void );
\ No newline at end of file
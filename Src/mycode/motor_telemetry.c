@@ -0,0 +1,158 @@
+#include <stddef.h>
+#include "stm32f4xx_hal.h"
+#include "stepping_motor.h"
+#include "motor_telemetry.h"
+#include "interrupt_timer.h"
+#include "serial_port.h"
+
+// Telemetry streaming
+// A frame of all motors is sent every 1/rate second by DMA, so the main
+// loop does not wait for the UART. When the previous frame is still being
+// sent the frame is dropped (counted in the header).
+//
+// Frame format (little endian, decoded by tools/telemetry_decode.py)
+//   header : 'T','L', version, motor count, sequence(u16), isr load(u16, permille),
+//            tick(u32, ms), dropped frames(u16), frame size(u16)
+//   motor  : position(i32), target position(i32), effective pps(i32),
+//            status(u8), run mode(u8), queue depth(u8), 0(u8)
+//   crc    : CRC-16/CCITT-FALSE of the bytes before (u16), 0(u16)
+// Effective pps is the position change per second measured over the frame
+// period (also for geared motors).
+#define TELEMETRY_VERSION       (1)
+#define TELEMETRY_RATE_MAX      (100)       // frames per second (115200bps : about 11k bytes per second)
+
+// Telemetry header structure
+typedef struct {
+    uint8_t             magic[2];               // 'T','L'
+    uint8_t             version;                // frame version
+    uint8_t             motors;                 // motor count
+    uint16_t            sequence;               // frame sequence number
+    uint16_t            isr_load;               // timer interrupt load (permille)
+    uint32_t            tick;                   // HAL tick (ms)
+    uint16_t            dropped;                // dropped frames (total)
+    uint16_t            size;                   // frame size
+}TELEMETRY_HEADER;
+
+// Telemetry motor structure
+typedef struct {
+    int32_t             motor_position;         // motor position
+    int32_t             target_position;        // target position
+    int32_t             pps;                    // effective PPS (signed)
+    uint8_t             status;                 // motor status
+    uint8_t             run_mode;               // run mode
+    uint8_t             queue_depth;            // queued moves
+    uint8_t             reserved;
+}TELEMETRY_MOTOR;
+
+// Telemetry frame structure
+typedef struct {
+    TELEMETRY_HEADER    header;                 // header
+    TELEMETRY_MOTOR     motor[MOTOR_MAX];       // motors
+    uint16_t            crc;                    // CRC-16/CCITT-FALSE
+    uint16_t            reserved;
+}TELEMETRY_FRAME;
+
+// Frame is not written while DMA is sending it
+static TELEMETRY_FRAME  s_Frame;
+static uint32_t         s_Rate      = 0;        // frames per second (0 : stop)
+static uint32_t         s_Period    = 0;        // frame period (ms)
+static uint32_t         s_NextTick  = 0;        // next frame (HAL tick)
+static uint32_t         s_LastTick  = 0;        // last frame (HAL tick)
+static uint32_t         s_LastClock = 0;        // last frame (DWT cycles)
+static uint32_t         s_LastIsr   = 0;        // last frame (interrupt cycles)
+static int64_t          s_LastPosition[MOTOR_MAX];
+static uint16_t         s_Sequence  = 0;
+static uint16_t         s_Dropped   = 0;
+
+// Private functions definition
+static void MotorTelemetryBuild( uint32_t now );
+
+// function : Build 1 frame
+static void MotorTelemetryBuild( uint32_t now )
+{
+    MOTOR_STATE state;
+    uint32_t clock   = DWT->CYCCNT;
+    uint32_t isr     = TimerGetCycles();
+    uint32_t elapsed = now - s_LastTick;
+    uint32_t cycles  = clock - s_LastClock;
+    if( elapsed == 0 )  elapsed = 1;
+    if( cycles == 0 )   cycles = 1;
+
+    TELEMETRY_HEADER* pHead = &(s_Frame.header);
+    pHead->magic[0] = 'T';
+    pHead->magic[1] = 'L';
+    pHead->version  = TELEMETRY_VERSION;
+    pHead->motors   = MOTOR_MAX;
+    pHead->sequence = s_Sequence;
+    pHead->isr_load = (uint16_t)(((uint64_t)(isr - s_LastIsr) * 1000) / cycles);
+    pHead->tick     = now;
+    pHead->dropped  = s_Dropped;
+    pHead->size     = sizeof(TELEMETRY_FRAME);
+
+    for(uint16_t nMotor=0; nMotor < MOTOR_MAX; nMotor++ ){
+        TELEMETRY_MOTOR* pMotor = &(s_Frame.motor[nMotor]);
+        MotorGetState( nMotor, &state );
+        pMotor->motor_position  = (int32_t)state.motor_position;
+        pMotor->target_position = (int32_t)state.target_position;
+        pMotor->pps             = (int32_t)(((state.motor_position - s_LastPosition[nMotor]) * 1000) / (int64_t)elapsed);
+        pMotor->status          = (uint8_t)state.status;
+        pMotor->run_mode        = (uint8_t)state.run_mode;
+        pMotor->queue_depth     = (uint8_t)state.queue_depth;
+        pMotor->reserved        = 0;
+        s_LastPosition[nMotor]  = state.motor_position;
+    }
+    s_Frame.crc      = SerialCrc16( (const uint8_t*)&s_Frame, offsetof(TELEMETRY_FRAME, crc) );
+    s_Frame.reserved = 0;
+
+    s_LastTick  = now;
+    s_LastClock = clock;
+    s_LastIsr   = isr;
+}
+
+// function : Set frame rate (frames per second, 0 : stop)
+void MotorTelemetrySetRate( uint32_t rate )
+{
+    if( rate > TELEMETRY_RATE_MAX )     rate = TELEMETRY_RATE_MAX;
+
+    uint32_t now = HAL_GetTick();
+    s_Rate     = rate;
+    s_Period   = (rate != 0) ? (1000 / rate) : 0;
+    s_NextTick = now + s_Period;
+    // Measurement starts now
+    s_LastTick  = now;
+    s_LastClock = DWT->CYCCNT;
+    s_LastIsr   = TimerGetCycles();
+    for(uint16_t nMotor=0; nMotor < MOTOR_MAX; nMotor++ ){
+        s_LastPosition[nMotor] = MotorGetPosition( nMotor );
+    }
+}
+
+// function : Get frame rate
+uint32_t MotorTelemetryGetRate( void )
+{
+    return s_Rate;
+}
+
+// function : Send a frame when the period has passed (call from main loop)
+void MotorTelemetryProcess( void )
+{
+    if( s_Rate == 0 )   return;
+
+    uint32_t now = HAL_GetTick();
+    if( (int32_t)(now - s_NextTick) < 0 )   return;
+    s_NextTick += s_Period;
+    // skip the missed periods
+    if( (int32_t)(now - s_NextTick) >= 0 )  s_NextTick = now + s_Period;
+
+    // Previous frame is still being sent
+    if( SerialIsBusy() != 0 ){
+        s_Dropped++;
+        return;
+    }
+    MotorTelemetryBuild( now );
+    if( SerialWriteAsync( (const uint8_t*)&s_Frame, sizeof(TELEMETRY_FRAME) ) == 0 ){
+        s_Dropped++;
+        return;
+    }
+    s_Sequence++;
+}
@@ -0,0 +1,6 @@
+// Telemetry rate of the serial command (frames per second)
+#define TELEMETRY_DEFAULT_RATE  (10)
+
+void MotorTelemetrySetRate( uint32_t rate );
+uint32_t MotorTelemetryGetRate( void );
+void MotorTelemetryProcess( void );
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include "stm32f4xx_hal.h"
+#include "stepping_motor.h"
+#include "motor_trace.h"
+#include "serial_port.h"
+
+// Motion trace ring buffer
+// Records are written only in timer interrupt, so no lock is needed.
+// The head is free-running and the ring index is (head & mask).
+//
+// Dump format (little endian, decoded by tools/trace_decode.py)
+//   header : 'M','T','R','C', version, motor count, record size, 0
+//   motor  : motor number(u16), record count(u16), records (oldest first)
+//   record : tick(u32), position(i32), status(u8), phase index(u8), 0(u16)
+#define TRACE_VERSION       (1)
+#define TRACE_MOTOR_MAX     (MOTOR_MAX) // the number of traced motors
+#define TRACE_SIZE          (256)       // records per motor (power of 2)
+#define TRACE_MASK          (TRACE_SIZE - 1)
+
+// Trace record structure
+typedef struct {
+    uint32_t            tick;                   // timer interrupt count
+    int32_t             position;               // motor position
+    uint8_t             status;                 // motor status
+    uint8_t             phase_index;            // phase current index
+    uint16_t            reserved;
+}MOTOR_TRACE_RECORD;
+
+// Trace ring structure
+typedef struct {
+    uint32_t            head;                   // next write count
+    uint32_t            last_status;            // last recorded status
+    MOTOR_TRACE_RECORD  record[TRACE_SIZE];     // records
+}MOTOR_TRACE_RING;
+
+static MOTOR_TRACE_RING     traces[TRACE_MOTOR_MAX];
+static uint32_t             s_TraceTick   = 0;
+static volatile uint32_t    s_TraceFreeze = 0;
+
+// function : Set trace tick (call at each motor update tick)
+MOTOR_RAM_FUNC void MotorTraceTick( uint32_t tick )
+{
+    s_TraceTick = tick;
+}
+
+// function : Record (status change or step)
+MOTOR_RAM_FUNC void MotorTraceRecord( uint16_t nMotor, uint32_t status, uint32_t phase_index, int32_t position, uint32_t step )
+{
+    if( nMotor > (TRACE_MOTOR_MAX - 1) )    return;
+
+    MOTOR_TRACE_RING* pRing = &(traces[nMotor]);
+    if( (step == 0) && (status == pRing->last_status) ) return;
+    if( s_TraceFreeze != 0 )    return;
+
+    MOTOR_TRACE_RECORD* pRec = &(pRing->record[pRing->head & TRACE_MASK]);
+    pRec->tick        = s_TraceTick;
+    pRec->position    = position;
+    pRec->status      = (uint8_t)status;
+    pRec->phase_index = (uint8_t)phase_index;
+    pRec->reserved    = 0;
+    pRing->last_status = status;
+    pRing->head++;
+}
+
+// function : Dump all records to serial port (binary)
+void MotorTraceDump( void )
+{
+    const uint8_t header[8] = { 'M', 'T', 'R', 'C', TRACE_VERSION, TRACE_MOTOR_MAX, sizeof(MOTOR_TRACE_RECORD), 0 };
+
+    // Stop recording while sending (ring is not overwritten)
+    s_TraceFreeze = 1;
+
+    SerialWrite( header, sizeof(header) );
+    for(uint16_t nMotor=0; nMotor < TRACE_MOTOR_MAX; nMotor++ ){
+        MOTOR_TRACE_RING* pRing = &(traces[nMotor]);
+        uint32_t head  = pRing->head;
+        uint32_t count = (head < TRACE_SIZE) ? head : TRACE_SIZE;
+        uint8_t  info[4] = { (uint8_t)nMotor, (uint8_t)(nMotor >> 8), (uint8_t)count, (uint8_t)(count >> 8) };
+
+        SerialWrite( info, sizeof(info) );
+        for(uint32_t n = head - count; n != head; n++ ){
+            SerialWrite( (const uint8_t*)&(pRing->record[n & TRACE_MASK]), sizeof(MOTOR_TRACE_RECORD) );
+        }
+    }
+
+    s_TraceFreeze = 0;
+}
@@ -0,0 +1,16 @@
+// Motion trace
+// 1 : record status change and step of each motor in RAM
+// 0 : no trace (no cost in timer interrupt)
+#define MOTOR_TRACE_ENABLE      (1)
+
+#if MOTOR_TRACE_ENABLE
+#define MOTOR_TRACE_TICK(tick)                      MotorTraceTick( (tick) )
+#define MOTOR_TRACE(nMotor,status,index,pos,step)   MotorTraceRecord( (nMotor), (status), (index), (pos), (step) )
+#else
+#define MOTOR_TRACE_TICK(tick)                      ((void)0)
+#define MOTOR_TRACE(nMotor,status,index,pos,step)   ((void)0)
+#endif
+
+void MotorTraceTick( uint32_t tick );
+void MotorTraceRecord( uint16_t nMotor, uint32_t status, uint32_t phase_index, int32_t position, uint32_t step );
+void MotorTraceDump( void );
\ No newline at end of file
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "stepping_motor.h"
+#include "motor_wave.h"
+#include "motor_encoder.h"
+#include "serial_port.h"
+
+// Coil waveform recorder
+// Fixed move cases are run by calling the TIM2 period elapsed callback
+// directly (TIM2 interrupt disabled), and the output pins of all motors are
+// recorded every tick as run-length text:
+//   case <name>
+//   <state(hex, 4bit per motor: A1,B1,A2,B2)> <ticks>
+//   end <total ticks>
+// Two recordings (e.g. before and after a refactoring of the timer
+// interrupt path) must be identical; tools/wave_compare.py compares a
+// recording with the golden file (tools/golden/wave.txt) and shows the
+// first different tick.
+// After the last step the coils are held for the break timeout, which is 1
+// step period of the move (1 tick at 1000 PPS, 20 ticks at 50 PPS), then
+// the output is off and the case ends WAVE_TAIL_TICKS later.
+// A case with encoder loss (ENCODER_SIMULATION only) slips the rotor of
+// motor 0 WAVE_LOSS_TICKS after the start; the following error stops the
+// motor, and the line "encoder ok" before "end" shows that ENS_FOLLOWING_ERROR
+// is reported and the position is re-synced to the measured position
+// ("encoder error" otherwise).
+//
+// NOTE : every case starts from position 0 / phase index 0 without
+//        backlash compensation and automatic phase switching, so the motor
+//        position and these settings are lost after recording.
+
+#define WAVE_TAIL_TICKS     (5)         // ticks recorded after IDLE
+#define WAVE_MAX_TICKS      (20000)     // ticks limit per case
+#define WAVE_LOSS_TICKS     (4)         // ticks before the encoder loss
+
+extern TIM_HandleTypeDef	htim2;
+
+// Waveform case structure
+typedef struct {
+    const char*         name;                   // case name
+    PHASE_MODE          phase_mode;             // phase mode
+    uint32_t            pps;                    // PPS
+    int32_t             start;                  // start position
+    int32_t             target;                 // target position
+    uint32_t            gear;                   // 1 : motor 1 follows (HALF-STEP, 1:1), motor 0 moves back to start
+    int32_t             loss;                   // encoder loss of motor 0 (steps, 0 : none)
+}WAVE_CASE;
+
+static const WAVE_CASE sc_WaveCase[] = {
+    { "full_cw",    MTP_PHASE_FULL, 1000,   0,  12, 0,  0   },
+    { "full_ccw",   MTP_PHASE_FULL, 1000,   0, -12, 0,  0   },
+    { "full_slow",  MTP_PHASE_FULL,   50,   0,   3, 0,  0   },
+    { "half_cw",    MTP_PHASE_HALF,  500,   0,   4, 0,  0   },
+    { "half_ccw",   MTP_PHASE_HALF,  500,   0,  -4, 0,  0   },
+    { "zero",       MTP_PHASE_FULL, 1000,   0,   0, 0,  0   },
+#if MOTOR_MAX > 1
+    { "gear_rev",   MTP_PHASE_FULL, 1000,   0,   4, 1,  0   },  // slave reverses at a half step
+#endif
+#if ENCODER_SIMULATION
+    { "enc_loss",   MTP_PHASE_FULL, 1000,   0,  12, 0,  3   },  // over the threshold (2 steps)
+#endif
+};
+#define WAVE_CASE_NUM   (sizeof(sc_WaveCase) / sizeof(sc_WaveCase[0]))
+
+// Private functions definition
+static uint32_t WaveOutput( void );
+static uint32_t WaveIsBusy( void );
+static void WaveEmit( uint32_t state, uint32_t ticks );
+static uint32_t WaveCheckLoss( void );
+static void WaveRunCase( const WAVE_CASE* const pCase );
+
+// function : Output state of all motors
+static uint32_t WaveOutput( void )
+{
+    uint32_t state = 0;
+    for(uint16_t nMotor=0; nMotor < MOTOR_MAX; nMotor++ ){
+        state |= MotorGetOutput( nMotor ) << (nMotor * 4);
+    }
+    return state;
+}
+
+// function : Check for any motor busy
+static uint32_t WaveIsBusy( void )
+{
+    for(uint16_t nMotor=0; nMotor < MOTOR_MAX; nMotor++ ){
+        if( MotorIsBusy( nMotor ) != 0 )   return 1;
+    }
+    return 0;
+}
+
+// function : Emit 1 run
+static void WaveEmit( uint32_t state, uint32_t ticks )
+{
+    char line[24];
+    int  len = snprintf( line, sizeof(line), "%lX %lu\r\n", (unsigned long)state, (unsigned long)ticks );
+    SerialWrite( (const uint8_t*)line, (uint16_t)len );
+}
+
+// function : Check the following error and the re-sync of motor 0 (1 : ok)
+static uint32_t WaveCheckLoss( void )
+{
+    if( MotorEncoderStatus( 0 ) != ENS_FOLLOWING_ERROR )    return 0;
+    if( MotorGetPosition( 0 ) != MotorEncoderGetPosition( 0 ) ) return 0;
+    return 1;
+}
+
+// function : Run and record 1 case
+static void WaveRunCase( const WAVE_CASE* const pCase )
+{
+    char     line[48];
+    uint32_t total = 0;
+    uint32_t tail  = 0;
+    int      len;
+
+    // Same start for every case (no runtime settings of the motion)
+    for(uint16_t nMotor=0; nMotor < MOTOR_MAX; nMotor++ ){
+        MotorSetBacklash( nMotor, 0, 0 );
+        MotorSetAutoPhase( nMotor, 0 );
+        MotorResetPhase( nMotor );
+        MotorSetPosition( nMotor, pCase->start );
+        MotorSetPhaseMode( nMotor, pCase->phase_mode );
+    }
+    MotorEncoderClearError( 0 );
+
+    len = snprintf( line, sizeof(line), "case %s\r\n", pCase->name );
+    SerialWrite( (const uint8_t*)line, (uint16_t)len );
+
+    if( pCase->gear != 0 ){
+        MotorSetPhaseMode( 1, MTP_PHASE_HALF );
+        MotorGear( 1, 0, 1, 1 );
+    }
+    MotorMove( 0, pCase->pps, pCase->target );
+    if( pCase->gear != 0 )  (void)MotorQueueMove( 0, pCase->pps, pCase->start );
+    uint32_t state = WaveOutput();
+    uint32_t run   = 0;
+    while( (tail < WAVE_TAIL_TICKS) && (total < WAVE_MAX_TICKS) ){
+        HAL_TIM_PeriodElapsedCallback( &htim2 );
+        total++;
+#if ENCODER_SIMULATION
+        if( (pCase->loss != 0) && (total == WAVE_LOSS_TICKS) )  MotorEncoderInjectLoss( 0, pCase->loss );
+#endif
+        // Gear is stopped when the slave is back at the position of the master
+        if( (pCase->gear != 0) && (MotorIsBusy( 0 ) == 0) && (MotorGetPosition( 1 ) == MotorGetPosition( 0 )) ){
+            MotorStop( 1 );
+        }
+        if( WaveIsBusy() == 0 ) tail++;
+
+        uint32_t now = WaveOutput();
+        if( now != state ){
+            if( run != 0 )  WaveEmit( state, run );
+            state = now;
+            run   = 0;
+        }
+        run++;
+    }
+    WaveEmit( state, run );
+
+    if( pCase->loss != 0 ){
+        len = snprintf( line, sizeof(line), "encoder %s\r\n", (WaveCheckLoss() != 0) ? "ok" : "error" );
+        SerialWrite( (const uint8_t*)line, (uint16_t)len );
+    }
+
+    len = snprintf( line, sizeof(line), "end %lu\r\n", (unsigned long)total );
+    SerialWrite( (const uint8_t*)line, (uint16_t)len );
+}
+
+// function : Record all cases to serial port
+void MotorWaveRun( void )
+{
+    // Timer interrupt is replaced by direct call
+    HAL_NVIC_DisableIRQ( TIM2_IRQn );
+    for(uint16_t nMotor=0; nMotor < MOTOR_MAX; nMotor++ ){
+        MotorStop( nMotor );
+    }
+    while( WaveIsBusy() != 0 ){
+        HAL_TIM_PeriodElapsedCallback( &htim2 );
+    }
+
+    for(uint32_t nCase=0; nCase < WAVE_CASE_NUM; nCase++ ){
+        WaveRunCase( &sc_WaveCase[nCase] );
+    }
+
+    // Back to default phase mode
+    for(uint16_t nMotor=0; nMotor < MOTOR_MAX; nMotor++ ){
+        MotorSetPhaseMode( nMotor, MTP_PHASE_FULL );
+    }
+    MotorEncoderClearError( 0 );
+    HAL_NVIC_EnableIRQ( TIM2_IRQn );
+}
@@ -0,0 +1 @@
+void MotorWaveRun( void );
\ No newline at end of file
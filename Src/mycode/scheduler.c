@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "scheduler.h"
+#include "interrupt_button.h"
+#include "motor_home.h"
+#include "motor_telemetry.h"
+#include "serial_port.h"
+#include "user_main.h"
+#if SCHEDULER_RTOS_ENABLE
+#include "FreeRTOS.h"
+#include "task.h"
+#endif
+
+// Cooperative scheduler (run to completion)
+// A task is ready when its period has passed or one of its events is
+// signaled (SchedulerSignal(), also from interrupts). SchedulerRun() runs
+// the ready task with the highest priority to the end and returns, so a
+// higher priority task waits for 1 task at most. When no task is ready the
+// CPU sleeps (WFI) until the next interrupt; the timer interrupt wakes it
+// every tick.
+//
+// CPU load : cycles of each task and of sleep are counted with the DWT
+// cycle counter and converted to permille every SCHEDULER_LOAD_WINDOW ms.
+//
+// RTOS (SCHEDULER_RTOS_ENABLE 1) : each task is a FreeRTOS thread with the
+// priority of the table order, which waits for a task notification
+// (SchedulerSignal()) or its period. The timer interrupt only steps the
+// motors; the plan thread refills the segment queues when a segment is
+// taken (SEV_MOTOR) and preempts input / homing / command threads.
+// Task cycles include the time preempted by higher priority threads, and
+// sleep is counted in the idle hook. Periods are HAL ticks, which count with
+// the RTOS tick on SysTick (1 RTOS tick is 1ms).
+#define SCHEDULER_LOAD_WINDOW   (1000)  // ms
+#if SCHEDULER_RTOS_ENABLE
+#define SCHEDULER_STACK_SIZE    (256)   // stack words per thread
+#define SCHEDULER_IN_ISR()      (__get_IPSR() != 0U)
+// NVIC priority of the interrupts calling FromISR APIs (serial is 1 lower)
+#define SCHEDULER_IRQ_PRIORITY  (configMAX_SYSCALL_INTERRUPT_PRIORITY >> (8 - __NVIC_PRIO_BITS))
+typedef char scheduler_check_tick_rate[(configTICK_RATE_HZ == 1000) ? 1 : -1];
+typedef char scheduler_check_irq_priority[((SCHEDULER_IRQ_PRIORITY + 1) < (1 << __NVIC_PRIO_BITS)) ? 1 : -1];
+#endif
+
+// Task information structure
+typedef struct {
+    const char*         name;                   // task name
+    void                (*function)( void );    // task function
+    uint32_t            period;                 // period (ms, 0 : events only)
+    uint32_t            events;                 // wake up events (SEV_xxx)
+    volatile uint32_t   signaled;               // 1 : event is signaled
+    uint32_t            next_tick;              // next periodic run (HAL tick)
+    uint32_t            runs;                   // runs in this window
+    uint32_t            cycles;                 // cycles in this window
+    uint32_t            load_runs;              // runs in the last window
+    uint32_t            load_permille;          // CPU load in the last window
+}TASK_INFO;
+
+// Task information
+static TASK_INFO        tasks[TSK_MAX] = {
+    {   "plan",         button_plan,            10, SEV_MOTOR,              0, 0, 0, 0, 0, 0 },
+    {   "input",        button_loop,            1,  SEV_INPUT,              0, 0, 0, 0, 0, 0 },
+    {   "home",         MotorHomeProcess,       1,  0,                      0, 0, 0, 0, 0, 0 },
+    {   "command",      UserCommand,            10, SEV_SERIAL | SEV_MOTOR, 0, 0, 0, 0, 0, 0 },
+    {   "telemetry",    MotorTelemetryProcess,  1,  0,                      0, 0, 0, 0, 0, 0 },
+};
+
+static uint32_t     s_SleepCycles;              // sleep cycles in this window
+static uint32_t     s_SleepPermille;            // sleep in the last window
+static uint32_t     s_WindowStart;              // window start (cycles)
+static uint32_t     s_WindowTick;               // window start (HAL tick)
+
+#if SCHEDULER_RTOS_ENABLE
+static TaskHandle_t s_Handle[TSK_MAX];          // thread handles
+static StaticTask_t s_TaskBuffer[TSK_MAX];      // thread control blocks
+static StackType_t  s_Stack[TSK_MAX][SCHEDULER_STACK_SIZE];
+static StaticTask_t s_IdleBuffer;               // idle thread control block
+static StackType_t  s_IdleStack[configMINIMAL_STACK_SIZE];
+#endif
+
+// Private functions definition
+static void SchedulerUpdateLoad( uint32_t now );
+static void SchedulerExecute( TASK_INFO* const pTask, uint32_t now );
+#if SCHEDULER_RTOS_ENABLE
+static void SchedulerThread( void* pParam );
+#else
+static TASK_INFO* SchedulerReady( uint32_t now );
+#endif
+
+#if !SCHEDULER_RTOS_ENABLE
+// function : Find the ready task with the highest priority (NULL : none)
+static TASK_INFO* SchedulerReady( uint32_t now )
+{
+    for(uint16_t nTask=0; nTask < TSK_MAX; nTask++ ){
+        TASK_INFO* pTask = &(tasks[nTask]);
+        if( pTask->signaled != 0 )  return pTask;
+        if( (pTask->period != 0) && ((int32_t)(now - pTask->next_tick) >= 0) )  return pTask;
+    }
+    return NULL;
+}
+#endif
+
+// function : Update CPU load at the end of window
+static void SchedulerUpdateLoad( uint32_t now )
+{
+    if( (now - s_WindowTick) < SCHEDULER_LOAD_WINDOW )  return;
+
+    uint32_t cycles = DWT->CYCCNT;
+    uint32_t total  = cycles - s_WindowStart;
+    if( total == 0 )    total = 1;
+    for(uint16_t nTask=0; nTask < TSK_MAX; nTask++ ){
+        TASK_INFO* pTask = &(tasks[nTask]);
+        pTask->load_permille = (uint32_t)(((uint64_t)pTask->cycles * 1000) / total);
+        pTask->load_runs     = pTask->runs;
+        pTask->cycles        = 0;
+        pTask->runs          = 0;
+    }
+    s_SleepPermille = (uint32_t)(((uint64_t)s_SleepCycles * 1000) / total);
+    s_SleepCycles   = 0;
+    s_WindowStart   = cycles;
+    s_WindowTick    = now;
+}
+
+// function : Run 1 task and account its cycles
+static void SchedulerExecute( TASK_INFO* const pTask, uint32_t now )
+{
+    pTask->signaled = 0;
+    if( pTask->period != 0 ){
+        pTask->next_tick += pTask->period;
+        // skip the missed periods
+        if( (int32_t)(now - pTask->next_tick) >= 0 )  pTask->next_tick = now + pTask->period;
+    }
+    uint32_t start = DWT->CYCCNT;
+    pTask->function();
+    pTask->cycles += DWT->CYCCNT - start;
+    pTask->runs++;
+}
+
+#if SCHEDULER_RTOS_ENABLE
+// function : Thread of 1 task (wait for the notification or the period)
+static void SchedulerThread( void* pParam )
+{
+    TASK_INFO* pTask = (TASK_INFO*)pParam;
+    for(;;){
+        TickType_t wait = portMAX_DELAY;
+        if( pTask->period != 0 ){
+            int32_t remain = (int32_t)(pTask->next_tick - HAL_GetTick());
+            wait = (remain > 0) ? pdMS_TO_TICKS( (uint32_t)remain ) : 0;
+        }
+        (void)ulTaskNotifyTake( pdTRUE, wait );
+        SchedulerExecute( pTask, HAL_GetTick() );
+    }
+}
+
+// function : Idle hook (sleep until an interrupt)
+void vApplicationIdleHook( void )
+{
+    uint32_t start = DWT->CYCCNT;
+    __WFI();
+    s_SleepCycles += DWT->CYCCNT - start;
+    SchedulerUpdateLoad( HAL_GetTick() );
+}
+
+// function : Memory of idle thread (static allocation)
+void vApplicationGetIdleTaskMemory( StaticTask_t** ppTcb, StackType_t** ppStack, uint32_t* pStackSize )
+{
+    *ppTcb      = &s_IdleBuffer;
+    *ppStack    = s_IdleStack;
+    *pStackSize = configMINIMAL_STACK_SIZE;
+}
+#endif
+
+// function : Initialize for Scheduler
+void SchedulerInitialize( void )
+{
+    // DWT cycle counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+
+    uint32_t now = HAL_GetTick();
+    for(uint16_t nTask=0; nTask < TSK_MAX; nTask++ ){
+        tasks[nTask].signaled  = 0;
+        tasks[nTask].next_tick = now;
+        tasks[nTask].runs      = 0;
+        tasks[nTask].cycles    = 0;
+    }
+    s_SleepCycles = 0;
+    s_WindowStart = DWT->CYCCNT;
+    s_WindowTick  = now;
+
+#if SCHEDULER_RTOS_ENABLE
+    // Interrupt priorities (same order as CubeMX : TIM2 = EXTI > USART2 = DMA)
+    HAL_NVIC_SetPriority( TIM2_IRQn,            SCHEDULER_IRQ_PRIORITY,     0 );
+    HAL_NVIC_SetPriority( EXTI0_IRQn,           SCHEDULER_IRQ_PRIORITY,     0 );
+    HAL_NVIC_SetPriority( EXTI15_10_IRQn,       SCHEDULER_IRQ_PRIORITY,     0 );
+    HAL_NVIC_SetPriority( USART2_IRQn,          SCHEDULER_IRQ_PRIORITY + 1, 0 );
+    HAL_NVIC_SetPriority( DMA1_Stream6_IRQn,    SCHEDULER_IRQ_PRIORITY + 1, 0 );
+
+    // Priority of the table order (TSK_PLAN is the highest)
+    for(uint16_t nTask=0; nTask < TSK_MAX; nTask++ ){
+        s_Handle[nTask] = xTaskCreateStatic( SchedulerThread, tasks[nTask].name, SCHEDULER_STACK_SIZE,
+                                             &(tasks[nTask]), tskIDLE_PRIORITY + (TSK_MAX - nTask),
+                                             s_Stack[nTask], &(s_TaskBuffer[nTask]) );
+    }
+#endif
+}
+
+// function : Run 1 ready task or sleep (call from main loop)
+// RTOS : start the threads (never returns)
+void SchedulerRun( void )
+{
+#if SCHEDULER_RTOS_ENABLE
+    vTaskStartScheduler();
+#else
+    uint32_t now = HAL_GetTick();
+    SchedulerUpdateLoad( now );
+
+    // Sleep until an interrupt when no task is ready
+    // (interrupt is masked while checking, WFI wakes up with the pending interrupt)
+    __disable_irq();
+    TASK_INFO* pTask = SchedulerReady( now );
+    if( pTask == NULL ){
+        uint32_t start = DWT->CYCCNT;
+        __WFI();
+        s_SleepCycles += DWT->CYCCNT - start;
+        __enable_irq();
+        return;
+    }
+    __enable_irq();
+
+    // Run
+    SchedulerExecute( pTask, now );
+#endif
+}
+
+// function : Signal events (also from interrupt)
+void SchedulerSignal( uint32_t events )
+{
+#if SCHEDULER_RTOS_ENABLE
+    BaseType_t woken = pdFALSE;
+    uint32_t   isr   = SCHEDULER_IN_ISR();
+#endif
+    for(uint16_t nTask=0; nTask < TSK_MAX; nTask++ ){
+        if( (tasks[nTask].events & events) == 0 )   continue;
+        tasks[nTask].signaled = 1;
+#if SCHEDULER_RTOS_ENABLE
+        if( isr != 0 )  vTaskNotifyGiveFromISR( s_Handle[nTask], &woken );
+        else            xTaskNotifyGive( s_Handle[nTask] );
+#endif
+    }
+#if SCHEDULER_RTOS_ENABLE
+    if( isr != 0 )  portYIELD_FROM_ISR( woken );
+#endif
+}
+
+// function : Send CPU load of the last window to serial port (JSON)
+void SchedulerReport( void )
+{
+    char line[80];
+    int  len = snprintf( line, sizeof(line), "{\"window_ms\":%u,\"sleep\":%lu,\"tasks\":[",
+                         (unsigned int)SCHEDULER_LOAD_WINDOW, (unsigned long)s_SleepPermille );
+    SerialWrite( (const uint8_t*)line, (uint16_t)len );
+    for(uint16_t nTask=0; nTask < TSK_MAX; nTask++ ){
+        len = snprintf( line, sizeof(line), "%s{\"name\":\"%s\",\"runs\":%lu,\"load\":%lu}",
+                        (nTask == 0) ? "" : ",", tasks[nTask].name,
+                        (unsigned long)tasks[nTask].load_runs, (unsigned long)tasks[nTask].load_permille );
+        SerialWrite( (const uint8_t*)line, (uint16_t)len );
+    }
+    SerialWrite( (const uint8_t*)"]}\r\n", 4 );
+}
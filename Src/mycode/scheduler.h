@@ -0,0 +1,31 @@
+// RTOS (FreeRTOS) : 1 : each task is a thread / 0 : cooperative scheduler
+// FreeRTOSConfig.h needs configSUPPORT_STATIC_ALLOCATION 1,
+// configUSE_IDLE_HOOK 1, INCLUDE_xTaskGetSchedulerState 1 and
+// configTICK_RATE_HZ 1000, and maps vPortSVCHandler / xPortPendSVHandler to
+// SVC_Handler / PendSV_Handler (their generation is off in the .ioc, so
+// stm32f4xx_it.c does not define them).
+// SchedulerInitialize() moves TIM2 / EXTI / USART2 / DMA interrupts to
+// configMAX_SYSCALL_INTERRUPT_PRIORITY and under (FromISR APIs are called).
+// SysTick_Handler() calls HAL_IncTick() and the RTOS tick, so HAL_GetTick()
+// and the RTOS tick count the same ms.
+#define SCHEDULER_RTOS_ENABLE   (0)
+
+// Scheduler event (bit)
+#define SEV_INPUT       (0x00000001)    // input edge (EXTI)
+#define SEV_SERIAL      (0x00000002)    // serial data received
+#define SEV_MOTOR       (0x00000004)    // motor segment taken from the queue
+
+// Task number (priority order, 0 : highest)
+typedef enum {
+    TSK_PLAN        = 0,    // motion planning (refill segment queues)
+    TSK_INPUT,              // inputs and button
+    TSK_HOME,               // homing sequence
+    TSK_COMMAND,            // serial command and G-code
+    TSK_TELEMETRY,          // telemetry streaming
+    TSK_MAX,                // the number of tasks
+}TASK_ID;
+
+void SchedulerInitialize( void );
+void SchedulerRun( void );
+void SchedulerSignal( uint32_t events );
+void SchedulerReport( void );
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "stm32f4xx_hal.h"
+#include "serial_port.h"
+#include "scheduler.h"
+
+extern UART_HandleTypeDef	huart2;
+static UART_HandleTypeDef	*s_phUart = &huart2;
+
+// Receive buffer (written in UART interrupt, read in main loop)
+#define SERIAL_RX_SIZE      (256)       // power of 2
+#define SERIAL_RX_MASK      (SERIAL_RX_SIZE - 1)
+static uint8_t              s_RxBuffer[SERIAL_RX_SIZE];
+static volatile uint32_t    s_RxHead = 0;
+static volatile uint32_t    s_RxTail = 0;
+static uint8_t              s_RxData;
+
+#define SERIAL_TX_TIMEOUT   (1000)      // ms
+
+// DMA transmit (SerialWriteAsync) : 1 while DMA is sending
+static volatile uint32_t    s_TxBusy = 0;
+
+// function : Initialize for Serial port
+void SerialInitialize( void )
+{
+    s_RxHead = 0;
+    s_RxTail = 0;
+    s_TxBusy = 0;
+    HAL_UART_Receive_IT( s_phUart, &s_RxData, 1 );
+}
+
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+    if (huart->Instance == s_phUart->Instance) {
+        // drop data when buffer is full
+        if( (s_RxHead - s_RxTail) < SERIAL_RX_SIZE ){
+            s_RxBuffer[s_RxHead & SERIAL_RX_MASK] = s_RxData;
+            s_RxHead++;
+        }
+        SchedulerSignal( SEV_SERIAL );
+        HAL_UART_Receive_IT( s_phUart, &s_RxData, 1 );
+    }
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+    if (huart->Instance == s_phUart->Instance) {
+        s_TxBusy = 0;
+    }
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+    if (huart->Instance == s_phUart->Instance) {
+        // restart receiving (overrun, framing error)
+        HAL_UART_Receive_IT( s_phUart, &s_RxData, 1 );
+    }
+}
+
+// function : Read 1 byte ( return 1 : received )
+uint32_t SerialRead( uint8_t* pData )
+{
+    if( s_RxHead == s_RxTail )  return 0;
+
+    *pData = s_RxBuffer[s_RxTail & SERIAL_RX_MASK];
+    s_RxTail++;
+    return 1;
+}
+
+// function : Write data (blocking)
+void SerialWrite( const uint8_t* pData, uint16_t size )
+{
+    // wait for the DMA transmit
+    while( s_TxBusy != 0 ){}
+    HAL_UART_Transmit( s_phUart, (uint8_t*)pData, size, SERIAL_TX_TIMEOUT );
+}
+
+// function : Write data by DMA ( return 0 : busy, not sent )
+// Data must be kept until the transmit is completed (SerialIsBusy() is 0).
+uint32_t SerialWriteAsync( const uint8_t* pData, uint16_t size )
+{
+    if( s_TxBusy != 0 ) return 0;
+
+    s_TxBusy = 1;
+    if( HAL_UART_Transmit_DMA( s_phUart, (uint8_t*)pData, size ) != HAL_OK ){
+        s_TxBusy = 0;
+        return 0;
+    }
+    return 1;
+}
+
+// function : DMA transmit is running ( return 1 : busy )
+uint32_t SerialIsBusy( void )
+{
+    return s_TxBusy;
+}
+
+// function : CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+// Used by the binary frames (telemetry, PVT table upload).
+uint16_t SerialCrc16( const uint8_t* pData, uint32_t size )
+{
+    uint16_t crc = 0xFFFF;
+    for(uint32_t n=0; n < size; n++ ){
+        crc ^= (uint16_t)pData[n] << 8;
+        for(uint16_t nBit=0; nBit < 8; nBit++ ){
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
@@ -0,0 +1,6 @@
+void SerialInitialize( void );
+uint32_t SerialRead( uint8_t* pData );
+void SerialWrite( const uint8_t* pData, uint16_t size );
+uint32_t SerialWriteAsync( const uint8_t* pData, uint16_t size );
+uint32_t SerialIsBusy( void );
+uint16_t SerialCrc16( const uint8_t* pData, uint32_t size );
\ No newline at end of file
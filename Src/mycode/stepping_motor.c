@@ -1,12 +1,29 @@
 #include "stm32f4xx_hal.h"
 #include "stepping_motor.h"
+#include "motor_backup.h"
+#include "motor_encoder.h"
+#include "motor_trace.h"
+#include "scheduler.h"
+#include "interrupt_timer.h"
 
 // Interrupt Timer interval
-#define INTERRUPT_TIMER_INTERVAL    (1000)    // 1000ms / Interrupt interval(ms)
 #define CALC_PPS_TIMER_COUNT(pps)   ((uint32_t)(INTERRUPT_TIMER_INTERVAL/pps))
+// PPS timer count of the motor (x2 while half-step runs as full-step)
+#define MOTOR_PPS_TIMER_COUNT(pMtr) (CALC_PPS_TIMER_COUNT((pMtr)->pps) << (pMtr)->phase_shift)
 
-// default value for PPS
-#define DEFAULT_PPS               (1000)
+// default value for breaking timeout
+#define DEFAULT_BREAK_TIMEOUT     (10)
+// default value for ramp (PPS change per step)
+#define DEFAULT_RAMP_PPS          (10)
+// default value for backlash take-up PPS
+#define DEFAULT_BACKLASH_PPS      (100)
+// start / reverse PPS for velocity mode
+#define RUN_PPS_MIN               (10)
+// Resonance band (forbidden PPS range)
+#define RESONANCE_BAND_MAX        (2)     // bands per motor
+#define RESONANCE_RAMP_GAIN       (4)     // ramp is x4 inside the band
+// Segment queue (position moves run back to back)
+#define MOTOR_QUEUE_MASK          (MOTOR_QUEUE_SIZE - 1)
 
 // Motor Status
 typedef enum {
@@ -15,6 +32,7 @@ typedef enum {
     MTS_RUN_CONST,          // RUNNING CONSTANT
     MTS_RUN_DECEL,          // RUNNING DECEL(Slow Down)
     MTS_BREAK,              // BREAKING(Have Timeout)
+    MTS_MAX,                // the number of status
 }MOTOR_STATUS;
 
 // Motor Direction
@@ -23,12 +41,20 @@ typedef enum {
     MTD_CCW,
 }MOTOR_DIRECTION;
 
+// Motor Run mode
+typedef enum {
+    MTM_POSITION    = 0,    // move to target position
+    MTM_VELOCITY,           // run at target velocity
+    MTM_GEAR,               // follow master motor at gear ratio
+    MTM_PVT,                // follow PVT table
+    MTM_MAX,                // the number of run mode
+}MOTOR_RUN_MODE;
+
 // Phase
 #define PHASE_A1    (0)
 #define PHASE_B1    (1)
 #define PHASE_A2    (2)
 #define PHASE_B2    (3)
-#define PHASE_MAX   (4)
 // Phase control index informations
 #define MOTOR_OFF_INDEX     (8)
 #define MOTOR_PHASE_MASK    (0x00000007)
@@ -37,25 +63,66 @@ typedef enum {
 //          CCW : 6 -> 4 -> 2 -> 0
 // 1-2Phase CW  : 0 -> 1 -> 2 -> 3 -> 4 -> 5 -> 6 -> 7 
 //          CCW : 7 -> 6 -> 5 -> 4 -> 3 -> 2 -> 1 -> 0
-static const GPIO_PinState sc_OutputState[MOTOR_OFF_INDEX+1][PHASE_MAX] = {
-    // A1               // B1           // A2           // B2
-    {GPIO_PIN_SET,      GPIO_PIN_RESET, GPIO_PIN_RESET, GPIO_PIN_SET    },
-    {GPIO_PIN_SET,      GPIO_PIN_RESET, GPIO_PIN_RESET, GPIO_PIN_RESET  },
-    {GPIO_PIN_SET,      GPIO_PIN_SET,   GPIO_PIN_RESET, GPIO_PIN_RESET  },
-    {GPIO_PIN_RESET,    GPIO_PIN_SET,   GPIO_PIN_RESET, GPIO_PIN_RESET  },
-    {GPIO_PIN_RESET,    GPIO_PIN_SET,   GPIO_PIN_SET,   GPIO_PIN_RESET  },
-    {GPIO_PIN_RESET,    GPIO_PIN_RESET, GPIO_PIN_SET,   GPIO_PIN_RESET  },
-    {GPIO_PIN_RESET,    GPIO_PIN_RESET, GPIO_PIN_SET,   GPIO_PIN_SET    },
-    {GPIO_PIN_RESET,    GPIO_PIN_RESET, GPIO_PIN_RESET, GPIO_PIN_SET    },
-    {GPIO_PIN_RESET,    GPIO_PIN_RESET, GPIO_PIN_RESET, GPIO_PIN_RESET  },
+// bit n : phase is ON at phase index n (index 8 : all OFF)
+//          index   0 1 2 3 4 5 6 7
+//          A1      1 1 1 0 0 0 0 0
+//          B1      0 0 1 1 1 0 0 0
+//          A2      0 0 0 0 1 1 1 0
+//          B2      1 0 0 0 0 0 1 1
+#define PHASE_A1_ON     (0x07u)
+#define PHASE_B1_ON     (0x1Cu)
+#define PHASE_A2_ON     (0x70u)
+#define PHASE_B2_ON     (0xC1u)
+
+// Motor configuration (MOTOR_CONFIG in stepping_motor.h)
+#define MOTOR_GPIO(port)            (GPIO##port)
+#define MOTOR_GPIO_BASE(port)       (GPIO##port##_BASE)
+// BSRR value of 1 pin at phase index (set when the phase is ON, reset when OFF)
+#define MOTOR_PIN_BSRR(on, nIndex, pin)     ((((on) >> (nIndex)) & 1u) ? (1u << (pin)) : (1u << ((pin) + 16)))
+// Pin code for the wiring check (port number * 16 + pin)
+#define MOTOR_PIN_CODE(port, pin)   ((((MOTOR_GPIO_BASE(port) - GPIOA_BASE) / (GPIOB_BASE - GPIOA_BASE)) * 16) + (pin))
+#define MOTOR_PIN_CASE(id, pa1, na1, pb1, nb1, pa2, na2, pb2, nb2, pps, mode, out) \
+    case MOTOR_PIN_CODE( pa1, na1 ):    case MOTOR_PIN_CODE( pb1, nb1 ): \
+    case MOTOR_PIN_CODE( pa2, na2 ):    case MOTOR_PIN_CODE( pb2, nb2 ):
+#define MOTOR_RESERVED_CASE(port, pin)  case MOTOR_PIN_CODE( port, pin ):
+// Compile time check (array size is -1 when the condition is false)
+#define MOTOR_STATIC_ASSERT(name, cond)     typedef char name[(cond) ? 1 : -1]
+#define MOTOR_ORDER(id, pa1, na1, pb1, nb1, pa2, na2, pb2, nb2, pps, mode, out) \
+    MOTOR_ORDER_##id,
+#define MOTOR_CHECK(id, pa1, na1, pb1, nb1, pa2, na2, pb2, nb2, pps, mode, out) \
+    MOTOR_STATIC_ASSERT( motor_check_number_##id,   (id) == MOTOR_ORDER_##id ); \
+    MOTOR_STATIC_ASSERT( motor_check_pin_##id,      ((na1) < 16) && ((nb1) < 16) && ((na2) < 16) && ((nb2) < 16) ); \
+    MOTOR_STATIC_ASSERT( motor_check_pps_##id,      ((pps) >= 1) && ((pps) <= INTERRUPT_TIMER_INTERVAL) ); \
+    MOTOR_STATIC_ASSERT( motor_check_mode_##id,     ((mode) == MTP_PHASE_FULL) || ((mode) == MTP_PHASE_HALF) ); \
+    MOTOR_STATIC_ASSERT( motor_check_output_##id,   ((out) == MOTOR_OUTPUT_PINS) || \
+                                                    (((out) == MOTOR_OUTPUT_PORT) && (MOTOR_GPIO_BASE(pa1) == MOTOR_GPIO_BASE(pb1)) \
+                                                     && (MOTOR_GPIO_BASE(pa1) == MOTOR_GPIO_BASE(pa2)) && (MOTOR_GPIO_BASE(pa1) == MOTOR_GPIO_BASE(pb2))) );
+#define MOTOR_RESERVED_CHECK(port, pin) \
+    MOTOR_STATIC_ASSERT( motor_check_reserved_##port##pin,  (pin) < 16 );
+// motor number must be the order in MOTOR_CONFIG (0, 1, 2, ...)
+enum { MOTOR_CONFIG( MOTOR_ORDER ) };
+MOTOR_CONFIG( MOTOR_CHECK )
+MOTOR_RESERVED( MOTOR_RESERVED_CHECK )
+
+// Statistics have 1 tick counter per status
+MOTOR_STATIC_ASSERT( motor_check_stats_status, MOTOR_STATS_STATUS == MTS_MAX );
+
+// Default values of MOTOR_CONFIG
+typedef struct {
+    uint16_t            pps;            // PPS
+    PHASE_MODE          phase_mode;     // phase mode
+}MOTOR_DEFAULT;
+#define MOTOR_DEFAULT_ENTRY(id, pa1, na1, pb1, nb1, pa2, na2, pb2, nb2, pps, mode, out) \
+    { (pps), (mode) },
+static const MOTOR_DEFAULT sc_MotorDefault[MOTOR_MAX] = {
+    MOTOR_CONFIG( MOTOR_DEFAULT_ENTRY )
 };
 
-// Motor pin information structure
+// Resonance band structure ( low < pps < high is forbidden, 0-0 : not used )
 typedef struct {
-    GPIO_TypeDef*       port;           // GPIO PORT NUMBER
-    uint16_t            pin;            // GPIO PIN NUMBER
-    GPIO_PinState       output;         // PIN STATE(GPIO_PIN_SET,GPIO_PIN_RESET)         
-}MOTOR_PIN_INFO;
+    uint32_t            low;            // PPS low edge
+    uint32_t            high;           // PPS high edge
+}MOTOR_BAND_INFO;
 
 // Motor information structure
 typedef struct {
@@ -63,218 +130,687 @@ typedef struct {
     MOTOR_DIRECTION     direction;              // motor direction
     uint32_t            pps;                    // PPS
     uint32_t            pps_timer;              // PPS count down timer for phase output
+    uint32_t            pps_count;              // PPS timer count (timer value of phase output)
     PHASE_MODE          phase_mode;             // phase mode
     int32_t             phase_index_update_num; // phase index update number
+    int32_t             position_num;           // position update number (CW:+1 CCW:-1)
+    uint32_t            position_mask;          // position counts at (phase index & mask) = 0
     uint32_t            phase_index;            // phase current index
     uint32_t            phase_pos;              // phase current position
-    MOTOR_PIN_INFO      phase[PHASE_MAX];       // phase information
     uint32_t            break_timeout;          // breaking timeout
     uint32_t            break_timer;            // count down for breaking timeout 
-    int32_t             motor_position;         // motor position
-    int32_t             target_position;        // target position
+    int64_t             motor_position;         // motor position
+    int64_t             target_position;        // target position
+    MOTOR_RUN_MODE      run_mode;               // run mode
+    volatile int32_t    target_velocity;        // target velocity (signed PPS, CW:+ CCW:-)
+    uint32_t            ramp_pps;               // PPS change per step (velocity mode)
+    int32_t             step_delta;             // position change in this tick (-1,0,+1)
+    uint16_t            gear_master;            // master motor number (gear mode)
+    int32_t             gear_num;               // gear ratio numerator (signed)
+    int32_t             gear_den;               // gear ratio denominator
+    int32_t             gear_acc;               // gear ratio accumulator
+    int32_t             gear_pending;           // phase updates to be output (gear mode)
+    MOTOR_BAND_INFO     band[RESONANCE_BAND_MAX];   // resonance bands
+    uint32_t            auto_full_pps;          // half-step runs as full-step over this PPS (0 : not used)
+    uint32_t            phase_shift;            // 1 : half-step is running as full-step
+    int32_t             step_num;               // direction of the last step (+1, -1, 0 : none)
+    uint32_t            backlash;               // backlash (positions, 0 : not compensated)
+    uint32_t            backlash_pps;           // PPS of backlash take-up
+    uint32_t            backlash_pending;       // phase updates of backlash take-up to be output
+    volatile int32_t    backlash_offset;        // rotor position - motor_position (positions taken up)
+    MOTOR_STATS         stats;                  // statistics (increment only in timer interrupt)
 }MOTOR_INFO;
 
-// Motor information
-#define MOTOR_MAX       (1)             // the number of motors  
-static MOTOR_INFO       motors[MOTOR_MAX] = {
-    {   // Motor0 information
-        MTS_IDLE,       // motor status
-        MTD_CW,         // motor cw
-        DEFAULT_PPS,    // PPS
-        CALC_PPS_TIMER_COUNT(DEFAULT_PPS),      // PPS count down timer for phase output
-        MTP_PHASE_FULL, // phase mode
-        2,              // phase index update number
-        MOTOR_OFF_INDEX,// phase current index
-        0,              // phase current position
-        {               // phase(pin) information
-            {GPIOA, GPIO_PIN_10, GPIO_PIN_RESET},    // A1
-            {GPIOB, GPIO_PIN_5,  GPIO_PIN_RESET},    // B1
-            {GPIOA, GPIO_PIN_8,  GPIO_PIN_RESET},    // A2
-            {GPIOA, GPIO_PIN_9,  GPIO_PIN_RESET},    // B2
-        },
-        10,             // breaking timeout
-        0,              // count down for breaking timeout 
-        0,              // motor position
-        0,              // target position
-    },
-};
+// Motor information (set up by MotorInitialize)
+static MOTOR_INFO       motors[MOTOR_MAX];
+#define MOTOR_NUMBER(pMtr)  ((uint16_t)((pMtr) - &(motors[0])))
+
+// Segment structure
+typedef struct {
+    uint32_t            pps;                    // PPS
+    int64_t             position;               // target position
+}MOTOR_SEGMENT;
+
+// Segment queue structure
+// Written by MotorQueueMove (interrupt disabled) and read by timer interrupt.
+typedef struct {
+    volatile uint32_t   head;                   // next write count
+    volatile uint32_t   tail;                   // next read count
+    MOTOR_SEGMENT       segment[MOTOR_QUEUE_SIZE];  // segments
+}MOTOR_QUEUE;
+
+// Segment queues
+static MOTOR_QUEUE      queues[MOTOR_MAX];
+
+// PVT table
+// Points are converted to forward differences of the cubic (Hermite)
+// position of each segment when loaded, so the timer interrupt only adds.
+// Position is fixed point (PVT_FRACTION bits) relative to the segment start,
+// and the segment end is exact (no error is accumulated).
+#define PVT_FRACTION        (40)        // fraction bits of interpolated position
+#define PVT_TIME_MAX        (10000)     // ms per point (interpolation error < 0.5 step)
+
+// PVT segment structure
+typedef struct {
+    int64_t             d1;                     // 1st difference at the start
+    int64_t             d2;                     // 2nd difference at the start
+    int64_t             d3;                     // 3rd difference
+    int32_t             delta;                  // position change (steps)
+    uint32_t            ticks;                  // time (ticks)
+}MOTOR_PVT_SEGMENT;
+
+// PVT table structure
+typedef struct {
+    uint32_t            count;                  // segments
+    uint32_t            repeat;                 // 1 : repeat the cycle
+    uint32_t            unit;                   // phase updates per step checked at load (FULL:1 HALF:2)
+    MOTOR_PVT_SEGMENT   segment[MOTOR_PVT_POINT_MAX];   // segments
+}MOTOR_PVT_TABLE;
+
+// PVT information structure
+// Load writes the table which is not active, and the timer interrupt
+// switches to it at the end of the cycle (double buffer).
+typedef struct {
+    MOTOR_PVT_TABLE     table[2];               // table slots
+    volatile uint32_t   active;                 // running slot
+    volatile uint32_t   loaded;                 // 1 : the other slot is loaded
+    uint32_t            running;                // 1 : following the table (0 : finished)
+    uint32_t            segment;                // current segment
+    uint32_t            tick;                   // tick in the segment
+    int64_t             base;                   // segment start position (steps)
+    int64_t             p;                      // position from the segment start (fixed point)
+    int64_t             d1;                     // 1st difference
+    int64_t             d2;                     // 2nd difference
+    int64_t             target;                 // position of this tick (steps)
+    volatile uint32_t   cycles;                 // completed cycles
+}MOTOR_PVT;
+
+// PVT information
+static MOTOR_PVT        pvts[MOTOR_MAX];
+
+// Step timing
+// A motor is updated only at its deadline (tick). After an update the
+// handler state tells how many following ticks would only count down
+// (pps timer, break timer); the motor sleeps for them and the count down is
+// caught up at the next update. Deadlines are kept in a min-heap, so a tick
+// services the due motors only and the timer can sleep until the earliest
+// deadline (TIMER_COMPARE_ENABLE). API functions wake the motor for the
+// next tick before they change it.
+#define MOTOR_SLEEP_MAX     (0x40000000)    // ticks of IDLE (deadlines are compared as signed)
+
+// Wake information structure
+typedef struct {
+    uint32_t            deadline;               // next update (tick)
+    uint32_t            last;                   // last update (tick, count down is done until it)
+    uint32_t            index;                  // position in the heap
+}MOTOR_WAKE;
+
+// Wake information
+static MOTOR_WAKE       wakes[MOTOR_MAX];
+static uint16_t         s_WakeHeap[MOTOR_MAX];  // motor numbers, earliest deadline first
+static uint32_t         s_Now = 0;              // tick of the running update
+
+// Synchronized start
+// MotorArm stages a position move per motor, and MotorFire sets the bits
+// of the motors to start in 1 write. The timer interrupt takes all the bits
+// at the same tick and the motors make their first update at the next tick.
+MOTOR_STATIC_ASSERT( motor_check_fire_mask, MOTOR_MAX <= 32 );
+static MOTOR_SEGMENT    s_Armed[MOTOR_MAX];     // staged moves
+static uint32_t         s_ArmMask = 0;          // bit n : motor n has a staged move
+static volatile uint32_t s_FireMask = 0;        // bit n : start motor n (taken by timer interrupt)
 
 // Private functions definition 
 static void MotorUpdate( MOTOR_INFO* const pMtr );
-static void MotorUpdateNextStatus( MOTOR_INFO* const pMtr );
-static uint32_t MotorUpdatePhase( MOTOR_INFO* const pMtr );
-static uint32_t MotorUpdatePhaseIfConst( MOTOR_INFO* const pMtr );
-static uint32_t MotorUpdatePhaseIfBreak( MOTOR_INFO* const pMtr );
-static void MotorUpdateCurrentPosition( MOTOR_INFO* const pMtr );
+static uint32_t MotorUpdateIdle( MOTOR_INFO* const pMtr );
+static uint32_t MotorUpdateRunPosition( MOTOR_INFO* const pMtr );
+static uint32_t MotorUpdateRunVelocity( MOTOR_INFO* const pMtr );
+static uint32_t MotorUpdateRunGear( MOTOR_INFO* const pMtr );
+static uint32_t MotorUpdateRunPvt( MOTOR_INFO* const pMtr );
+static void MotorPvtAdvance( MOTOR_PVT* const pPvt );
+static void MotorPvtSegment( MOTOR_PVT* const pPvt );
+static int64_t MotorPvtDivide( int64_t num, int64_t den );
+static uint32_t MotorPvtPeakOver( int32_t v0, int32_t v1, int32_t position, int32_t ticks, int32_t limit );
+static uint32_t MotorUpdateBreak( MOTOR_INFO* const pMtr );
+static void MotorStep( MOTOR_INFO* const pMtr );
+static void MotorStepPhase( MOTOR_INFO* const pMtr );
+static uint32_t MotorUpdateBacklash( MOTOR_INFO* const pMtr );
+static void MotorLeavePosition( MOTOR_INFO* const pMtr );
+static void MotorUpdateVelocity( MOTOR_INFO* const pMtr );
+static void MotorUpdateAutoPhase( MOTOR_INFO* const pMtr );
+static uint32_t MotorIsInBand( const MOTOR_INFO* const pMtr, uint32_t pps );
+static uint32_t MotorAvoidBand( const MOTOR_INFO* const pMtr, uint32_t pps );
 static void MotorUpdatePPSTimer( MOTOR_INFO* const pMtr );
 static void MotorDecisionPhaseIndexUpdateNumber( MOTOR_INFO* const pMtr );
-static void MotorSetup( MOTOR_INFO* const pMtr );
 static void MotorOutput( const MOTOR_INFO* const pMtr );
+static void MotorSetupSegment( MOTOR_INFO* const pMtr, uint32_t pps, int64_t position );
+static uint32_t MotorNextSegment( MOTOR_INFO* const pMtr );
+static void MotorQueueFlush( MOTOR_INFO* const pMtr );
+static void MotorStartMove( MOTOR_INFO* const pMtr, uint32_t pps, int64_t position );
+static uint32_t MotorSleepTicks( const MOTOR_INFO* const pMtr );
+static void MotorSleep( MOTOR_INFO* const pMtr, uint32_t ticks );
+static uint32_t MotorWakeBefore( uint16_t nMotorA, uint16_t nMotorB );
+static void MotorWakeSort( uint16_t nMotor );
+static void MotorWake( MOTOR_INFO* const pMtr );
+static void MotorWakeAt( MOTOR_INFO* const pMtr, uint32_t now );
+static void MotorFireStart( uint32_t fire, uint32_t now );
+static void MotorStatsClear( MOTOR_STATS* const pStats );
+
+// Update handler ( [run mode][status], returns 1 when phase is output )
+// Every tick runs exactly 1 handler, so the timer interrupt path does not
+// walk the status checks.
+typedef uint32_t (*MOTOR_UPDATE_HANDLER)( MOTOR_INFO* const pMtr );
+static const MOTOR_UPDATE_HANDLER sc_UpdateHandler[MTM_MAX][MTS_MAX] MOTOR_RAM_CONST = {
+    // IDLE             // RUN_ACCEL            // RUN_CONST            // RUN_DECEL            // BREAK
+    {MotorUpdateIdle,   MotorUpdateRunPosition, MotorUpdateRunPosition, MotorUpdateRunPosition, MotorUpdateBreak    },  // POSITION
+    {MotorUpdateIdle,   MotorUpdateRunVelocity, MotorUpdateRunVelocity, MotorUpdateRunVelocity, MotorUpdateBreak    },  // VELOCITY
+    {MotorUpdateIdle,   MotorUpdateRunGear,     MotorUpdateRunGear,     MotorUpdateRunGear,     MotorUpdateBreak    },  // GEAR
+    {MotorUpdateIdle,   MotorUpdateRunPvt,      MotorUpdateRunPvt,      MotorUpdateRunPvt,      MotorUpdateBreak    },  // PVT
+};
 
 // function : Update for Motor information
-static void MotorUpdate( MOTOR_INFO* const pMtr )
+MOTOR_RAM_FUNC static void MotorUpdate( MOTOR_INFO* const pMtr )
 {
-    // Check Status
-    if( pMtr->status == MTS_IDLE )  return;
-    // Update Phase
-    if( MotorUpdatePhase( pMtr ) == 1 ){
-        MotorSetup( pMtr );
-        MotorOutput( pMtr );
-        MotorUpdateCurrentPosition( pMtr );
+    pMtr->step_delta = 0;
+    uint32_t step = sc_UpdateHandler[pMtr->run_mode][pMtr->status]( pMtr );
+    // Trace
+    MOTOR_TRACE( MOTOR_NUMBER(pMtr), pMtr->status, pMtr->phase_index, (int32_t)pMtr->motor_position, step );
+}
+
+// function : Update handler for IDLE
+MOTOR_RAM_FUNC static uint32_t MotorUpdateIdle( MOTOR_INFO* const pMtr )
+{
+    (void)pMtr;
+    return 0;
+}
+
+// function : Update handler for RUNNING (position mode)
+MOTOR_RAM_FUNC static uint32_t MotorUpdateRunPosition( MOTOR_INFO* const pMtr )
+{
+    if( pMtr->backlash_pending != 0 )   return MotorUpdateBacklash( pMtr );
+
+    uint32_t step = (pMtr->pps_timer == pMtr->pps_count) ? 1 : 0;
+    if( step != 0 ){
+        MotorStep( pMtr );
+        MotorUpdateAutoPhase( pMtr );
     }
-    // Update PPS Timer
     MotorUpdatePPSTimer( pMtr );
-    // Update status for next process
-    MotorUpdateNextStatus( pMtr );
+    // Target position reached
+    if( pMtr->target_position != pMtr->motor_position ) return step;
+    pMtr->stats.moves++;
+
+    // Next segment without stop (the interval starts from this step)
+    if( MotorNextSegment( pMtr ) != 0 ){
+        if( pMtr->status == MTS_RUN_CONST ){
+            pMtr->pps_timer = pMtr->pps_count;
+            MotorUpdatePPSTimer( pMtr );
+        }
+    }
+    else{
+        pMtr->status = MTS_BREAK;
+    }
+    return step;
 }
 
-// function : Update for motor Next status
-static void MotorUpdateNextStatus( MOTOR_INFO* const pMtr )
+// Backlash compensation
+// A position move in the other direction of the last step first takes up
+// the backlash : the phase is updated at backlash_pps without changing the
+// position, then the move runs at its PPS. A move reversed while taking up
+// takes back only the part already taken. Only position moves are
+// compensated, and the first move after start-up is not (the side of the
+// backlash is not known).
+MOTOR_RAM_FUNC static uint32_t MotorUpdateBacklash( MOTOR_INFO* const pMtr )
 {
-    switch( pMtr->status ){
-        default:
-        case MTS_IDLE:
-        case MTS_RUN_ACCEL:
-        case MTS_RUN_DECEL:
-            break;
-        case MTS_RUN_CONST:
-            if( pMtr->target_position == pMtr->motor_position ) pMtr->status = MTS_BREAK;
-            break;
-        case MTS_BREAK:
-            if( pMtr->break_timer == 0 ) pMtr->status = MTS_IDLE;
-            break;
+    uint32_t step = (pMtr->pps_timer == pMtr->pps_count) ? 1 : 0;
+    if( step != 0 ){
+        MotorStepPhase( pMtr );
+        // The rotor turns without the position (encoder check subtracts it)
+        if( (pMtr->phase_index & pMtr->position_mask) == 0 )    pMtr->backlash_offset += pMtr->position_num;
+        pMtr->backlash_pending--;
+        if( pMtr->backlash_pending == 0 ){
+            // The move starts 1 interval of its PPS after the take-up
+            pMtr->pps_count = MOTOR_PPS_TIMER_COUNT(pMtr);
+            pMtr->pps_timer = pMtr->pps_count;
+        }
     }
+    MotorUpdatePPSTimer( pMtr );
+    return step;
 }
 
-// function : Update for Phase Index
-static uint32_t MotorUpdatePhase( MOTOR_INFO* const pMtr )
+// function : Cancel backlash take-up when the run mode leaves position mode
+// (interrupt is disabled by caller) The PPS timer is reloaded from the PPS
+// of the move, so the next step is not at the take-up PPS.
+static void MotorLeavePosition( MOTOR_INFO* const pMtr )
 {
-    // Phase Index
-    // Check Constant stepping
-    if( MotorUpdatePhaseIfConst(pMtr) == 1 ) return 1;
-    // Check Breaking timeout
-    if( MotorUpdatePhaseIfBreak(pMtr) == 1 ) return 1;
+    if( pMtr->backlash_pending == 0 )   return;
 
-    return 0;
+    pMtr->backlash_pending = 0;
+    pMtr->pps_count        = MOTOR_PPS_TIMER_COUNT(pMtr);
+    pMtr->pps_timer        = pMtr->pps_count;
+}
+
+// function : Update handler for RUNNING (velocity mode)
+MOTOR_RAM_FUNC static uint32_t MotorUpdateRunVelocity( MOTOR_INFO* const pMtr )
+{
+    uint32_t step = (pMtr->pps_timer == pMtr->pps_count) ? 1 : 0;
+    if( step != 0 ){
+        MotorStep( pMtr );
+        MotorUpdateVelocity( pMtr );
+        MotorUpdateAutoPhase( pMtr );
+    }
+    MotorUpdatePPSTimer( pMtr );
+    return step;
+}
+
+// Gear stepping
+// Position change of the master in this tick is multiplied by gear_num and
+// accumulated; every gear_den of it is 1 position of the slave. The
+// remainder is kept in the accumulator, so there is no drift. Master must
+// have a smaller motor number (updated before the slave in the same tick).
+// Slave outputs 1 phase update per tick at most; the rest is pending.
+// In HALF-STEP a half step is completed before reversing (the pending
+// goes 1 further), so the position counts the same in both directions.
+MOTOR_RAM_FUNC static uint32_t MotorUpdateRunGear( MOTOR_INFO* const pMtr )
+{
+    // phase updates per position
+    int32_t unit = (pMtr->phase_mode == MTP_PHASE_FULL) ? 1 : 2;
+    // step_delta is of the last update (master is sleeping : no change)
+    if( wakes[pMtr->gear_master].last == s_Now ){
+        pMtr->gear_acc += motors[pMtr->gear_master].step_delta * pMtr->gear_num;
+    }
+    while( pMtr->gear_acc >= pMtr->gear_den ){
+        pMtr->gear_acc     -= pMtr->gear_den;
+        pMtr->gear_pending += unit;
+    }
+    while( pMtr->gear_acc <= -pMtr->gear_den ){
+        pMtr->gear_acc     += pMtr->gear_den;
+        pMtr->gear_pending -= unit;
+    }
+    if( pMtr->gear_pending == 0 )   return 0;
+
+    // Direction (at the counted position only)
+    if( (pMtr->phase_index & pMtr->position_mask) == 0 ){
+        MOTOR_DIRECTION direction = (pMtr->gear_pending > 0) ? MTD_CW : MTD_CCW;
+        if( direction != pMtr->direction ){
+            pMtr->direction = direction;
+            MotorDecisionPhaseIndexUpdateNumber( pMtr );
+        }
+    }
+    pMtr->gear_pending -= (pMtr->direction == MTD_CW) ? 1 : -1;
+
+    MotorStep( pMtr );
+    return 1;
 }
-static uint32_t MotorUpdatePhaseIfConst( MOTOR_INFO* const pMtr )
+
+// function : Update handler for RUNNING (PVT mode)
+// The motor follows the interpolated position with 1 phase update per tick.
+// In HALF-STEP a half step is completed before reversing, so the position
+// counts the same in both directions.
+MOTOR_RAM_FUNC static uint32_t MotorUpdateRunPvt( MOTOR_INFO* const pMtr )
 {
-    if( pMtr->status != MTS_RUN_CONST )  return 0;
-    if( pMtr->pps_timer != CALC_PPS_TIMER_COUNT(pMtr->pps) ) return 0;
+    MOTOR_PVT* const pPvt = &(pvts[MOTOR_NUMBER(pMtr)]);
+    if( pPvt->running != 0 )    MotorPvtAdvance( pPvt );
 
-    // Update
-    pMtr->phase_index += pMtr->phase_index_update_num;
-    pMtr->phase_index &= MOTOR_PHASE_MASK;
+    if( (pMtr->phase_index & pMtr->position_mask) == 0 ){
+        int64_t diff = pPvt->target - pMtr->motor_position;
+        if( diff == 0 ){
+            // Table finished
+            if( pPvt->running == 0 ){
+                pMtr->target_position = pMtr->motor_position;
+                pMtr->status          = MTS_BREAK;
+            }
+            return 0;
+        }
+        MOTOR_DIRECTION direction = (diff > 0) ? MTD_CW : MTD_CCW;
+        if( direction != pMtr->direction ){
+            pMtr->direction = direction;
+            MotorDecisionPhaseIndexUpdateNumber( pMtr );
+        }
+    }
+    MotorStep( pMtr );
     return 1;
 }
 
-static uint32_t MotorUpdatePhaseIfBreak( MOTOR_INFO* const pMtr )
+// function : Interpolate 1 tick of PVT table
+MOTOR_RAM_FUNC static void MotorPvtAdvance( MOTOR_PVT* const pPvt )
+{
+    const MOTOR_PVT_TABLE* pTable = &(pPvt->table[pPvt->active]);
+    const MOTOR_PVT_SEGMENT* pSeg = &(pTable->segment[pPvt->segment]);
+
+    pPvt->p  += pPvt->d1;
+    pPvt->d1 += pPvt->d2;
+    pPvt->d2 += pSeg->d3;
+    pPvt->tick++;
+    if( pPvt->tick < pSeg->ticks ){
+        pPvt->target = pPvt->base + ((pPvt->p + ((int64_t)1 << (PVT_FRACTION - 1))) >> PVT_FRACTION);
+        return;
+    }
+
+    // Segment end is exact
+    pPvt->base  += pSeg->delta;
+    pPvt->target = pPvt->base;
+    pPvt->segment++;
+    if( pPvt->segment < pTable->count ){
+        MotorPvtSegment( pPvt );
+        return;
+    }
+
+    // Cycle end : loaded table, repeat or finish
+    pPvt->cycles++;
+    pPvt->segment = 0;
+    if( pPvt->loaded != 0 ){
+        pPvt->active ^= 1;
+        pPvt->loaded  = 0;
+    }
+    else if( pTable->repeat == 0 ){
+        pPvt->running = 0;
+        return;
+    }
+    MotorPvtSegment( pPvt );
+}
+
+// function : Start the current segment of PVT table
+MOTOR_RAM_FUNC static void MotorPvtSegment( MOTOR_PVT* const pPvt )
+{
+    const MOTOR_PVT_SEGMENT* pSeg = &(pPvt->table[pPvt->active].segment[pPvt->segment]);
+    pPvt->tick = 0;
+    pPvt->p    = 0;
+    pPvt->d1   = pSeg->d1;
+    pPvt->d2   = pSeg->d2;
+}
+
+// function : Update handler for BREAKING
+// break_timer = 0 then output off and change status to IDLE
+// break_timer > 0 then output keep
+MOTOR_RAM_FUNC static uint32_t MotorUpdateBreak( MOTOR_INFO* const pMtr )
 {
-    if( pMtr->status != MTS_BREAK )  return 0;
-    
-    // Check Breaking timeout
+    // Queued segment (after stop of velocity mode or zero length segment)
+    if( MotorNextSegment( pMtr ) != 0 ) return 0;
+
     if( pMtr->break_timer > 0 ){
         pMtr->break_timer--;
     }
- 
-    // break_timer = 0 then output off and change status to IDLE
-    // break_timer > 0 then output keep
-    if( pMtr->break_timer == 0 ){
-        pMtr->phase_pos     = pMtr->phase_index;
-        pMtr->phase_index   = MOTOR_OFF_INDEX;
-        return 1;
+    if( pMtr->break_timer != 0 )    return 0;
+
+    // Output off (not a step)
+    pMtr->phase_pos     = pMtr->phase_index;
+    pMtr->phase_index   = MOTOR_OFF_INDEX;
+    MotorOutput( pMtr );
+    pMtr->status        = MTS_IDLE;
+    // Backup stopped position
+    MotorBackupSave( MOTOR_NUMBER(pMtr), pMtr->motor_position, pMtr->phase_pos );
+    return 1;
+}
+
+// function : Step 1 phase update and position
+// Phase index and position are updated with the signed increments made by
+// MotorDecisionPhaseIndexUpdateNumber(). Position counts when
+// (phase index & position_mask) is 0, so half-step counts at even index only.
+MOTOR_RAM_FUNC static void MotorStep( MOTOR_INFO* const pMtr )
+{
+    MotorStepPhase( pMtr );
+
+    // Position
+    pMtr->step_delta     = ((pMtr->phase_index & pMtr->position_mask) == 0) ? pMtr->position_num : 0;
+    pMtr->motor_position += pMtr->step_delta;
+}
+
+// function : Step 1 phase update (position is not changed)
+MOTOR_RAM_FUNC static void MotorStepPhase( MOTOR_INFO* const pMtr )
+{
+    // Phase (keep phase position, move can be restarted while running)
+    pMtr->phase_index    = (pMtr->phase_index + pMtr->phase_index_update_num) & MOTOR_PHASE_MASK;
+    pMtr->phase_pos      = pMtr->phase_index;
+    MotorOutput( pMtr );
+
+    // Statistics
+    pMtr->stats.steps++;
+    if( pMtr->position_num != pMtr->step_num ){
+        if( pMtr->step_num != 0 )   pMtr->stats.reversals++;
+        pMtr->step_num = pMtr->position_num;
+    }
+}
+
+// function : Update for Velocity (velocity mode, at step boundary)
+MOTOR_RAM_FUNC static void MotorUpdateVelocity( MOTOR_INFO* const pMtr )
+{
+    int32_t         velocity  = pMtr->target_velocity;
+    MOTOR_DIRECTION direction = (velocity >= 0) ? MTD_CW : MTD_CCW;
+    uint32_t        target    = (velocity >= 0) ? (uint32_t)velocity : (uint32_t)(-velocity);
+    uint32_t        ramp      = pMtr->ramp_pps;
+
+    // Pass through resonance band quickly
+    if( MotorIsInBand( pMtr, pMtr->pps ) != 0 ) ramp *= RESONANCE_RAMP_GAIN;
+
+    // Reverse or stop : slow down to the minimum first
+    // (HALF-STEP : at the counted position, 1 more half step if not)
+    if( (target == 0) || (direction != pMtr->direction) ){
+        if( pMtr->pps > (RUN_PPS_MIN + ramp) )            pMtr->pps -= ramp;
+        else if( pMtr->pps > RUN_PPS_MIN )                pMtr->pps  = RUN_PPS_MIN;
+        else if( (pMtr->phase_index & pMtr->position_mask) != 0 ){
+            // Half step to the counted position
+        }
+        else if( target == 0 ){
+            // Stop
+            pMtr->target_position = pMtr->motor_position;
+            pMtr->break_timer     = pMtr->break_timeout;
+            pMtr->status          = MTS_BREAK;
+            return;
+        }
+        else{
+            // Reverse
+            pMtr->direction = direction;
+            MotorDecisionPhaseIndexUpdateNumber( pMtr );
+        }
+        pMtr->status = MTS_RUN_DECEL;
+    }
+    // Ramp to target PPS
+    else if( pMtr->pps < target ){
+        pMtr->pps    = ((target - pMtr->pps) > ramp) ? (pMtr->pps + ramp) : target;
+        pMtr->status = (pMtr->pps == target) ? MTS_RUN_CONST : MTS_RUN_ACCEL;
+    }
+    else if( pMtr->pps > target ){
+        pMtr->pps    = ((pMtr->pps - target) > ramp) ? (pMtr->pps - ramp) : target;
+        pMtr->status = (pMtr->pps == target) ? MTS_RUN_CONST : MTS_RUN_DECEL;
     }
     else{
-        return 0;
+        pMtr->status = MTS_RUN_CONST;
     }
+
+    // New PPS from this step
+    pMtr->pps_count     = MOTOR_PPS_TIMER_COUNT(pMtr);
+    pMtr->pps_timer     = pMtr->pps_count;
+    pMtr->break_timeout = pMtr->pps_timer;
+}
+
+// function : Update for automatic Full-step / Half-step switching (at step boundary)
+// Half-step mode runs as full-step over auto_full_pps, and back under it.
+// PPS is kept as half-step PPS, so full-step outputs the phase at half the
+// rate with the same speed. Switching is done only at even phase index
+// (full-step phase), so no position is lost.
+MOTOR_RAM_FUNC static void MotorUpdateAutoPhase( MOTOR_INFO* const pMtr )
+{
+    if( pMtr->phase_index % 2 )         return;
+
+    uint32_t shift = 0;
+    if( (pMtr->phase_mode == MTP_PHASE_HALF) && (pMtr->auto_full_pps != 0) && (pMtr->pps > pMtr->auto_full_pps) ) shift = 1;
+    if( shift == pMtr->phase_shift )    return;
+
+    // New phase update from this step
+    pMtr->phase_shift   = shift;
+    MotorDecisionPhaseIndexUpdateNumber( pMtr );
+    pMtr->pps_count     = MOTOR_PPS_TIMER_COUNT(pMtr);
+    pMtr->pps_timer     = pMtr->pps_count;
+    pMtr->break_timeout = pMtr->pps_timer;
 }
 
-// function : Update for Current Position
-static void MotorUpdateCurrentPosition( MOTOR_INFO* const pMtr )
+// function : Check PPS in resonance band
+MOTOR_RAM_FUNC static uint32_t MotorIsInBand( const MOTOR_INFO* const pMtr, uint32_t pps )
 {
-    if( pMtr->phase_mode == MTP_PHASE_HALF ){
-        // now HALF-STEP position then return
-        if( pMtr->phase_index%2 ) return;
+    for(uint16_t nBand=0; nBand < RESONANCE_BAND_MAX; nBand++ ){
+        if( (pps > pMtr->band[nBand].low) && (pps < pMtr->band[nBand].high) ) return 1;
     }
+    return 0;
+}
 
-    // Update
-    if( pMtr->direction == MTD_CW ) pMtr->motor_position++;
-    else                            pMtr->motor_position--;
+// function : Clamp cruise PPS out of resonance bands (to the nearer edge)
+// The band is checked with the quantized rate of the PPS timer (e.g. 300 PPS
+// runs at 1000/3 = 333 PPS), and the result is the rate next to the edge.
+// The 1st band decides the direction, and an overlapping band moves it
+// further until no band contains the rate.
+static uint32_t MotorAvoidBand( const MOTOR_INFO* const pMtr, uint32_t pps )
+{
+    int32_t  step = 0;      // -1 : below low edge, +1 : above high edge
+    for(uint16_t nLoop=0; nLoop < ((RESONANCE_BAND_MAX * 2) + 1); nLoop++ ){
+        uint32_t rate = INTERRUPT_TIMER_INTERVAL / CALC_PPS_TIMER_COUNT(pps);
+
+        const MOTOR_BAND_INFO* pBand = NULL;
+        for(uint16_t nBand=0; nBand < RESONANCE_BAND_MAX; nBand++ ){
+            if( (rate > pMtr->band[nBand].low) && (rate < pMtr->band[nBand].high) ){
+                pBand = &(pMtr->band[nBand]);
+                break;
+            }
+        }
+        if( pBand == NULL ) return pps;
+
+        // Quantized rates next to the edges (0 : none)
+        uint32_t low  = (pBand->low  != 0) ? (INTERRUPT_TIMER_INTERVAL / ((INTERRUPT_TIMER_INTERVAL + pBand->low - 1) / pBand->low)) : 0;
+        uint32_t high = (pBand->high <= INTERRUPT_TIMER_INTERVAL) ? (INTERRUPT_TIMER_INTERVAL / CALC_PPS_TIMER_COUNT(pBand->high)) : 0;
+        if( (low == 0) && (high == 0) )     return pps;
+
+        if( step == 0 ){
+            step = ((high == 0) || ((low != 0) && ((rate - low) <= (high - rate)))) ? -1 : 1;
+        }
+        if( low  == 0 )     step =  1;
+        if( high == 0 )     step = -1;
+        pps = (step > 0) ? high : low;
+    }
+    return INTERRUPT_TIMER_INTERVAL / CALC_PPS_TIMER_COUNT(pps);
 }
 
 // function : Update for PPS Timer
-static void MotorUpdatePPSTimer( MOTOR_INFO* const pMtr )
+MOTOR_RAM_FUNC static void MotorUpdatePPSTimer( MOTOR_INFO* const pMtr )
 {
-    if( pMtr->status != MTS_RUN_CONST )  return;
-
     // Check Phase Update time
     pMtr->pps_timer--;
     if( pMtr->pps_timer == 0 ){
         // Reset pps_timer
-        pMtr->pps_timer = CALC_PPS_TIMER_COUNT(pMtr->pps);
+        pMtr->pps_timer = pMtr->pps_count;
     }
 }
 
 // function : Desision Phase Index Update Number
-static void MotorDecisionPhaseIndexUpdateNumber( MOTOR_INFO* const pMtr )
+MOTOR_RAM_FUNC static void MotorDecisionPhaseIndexUpdateNumber( MOTOR_INFO* const pMtr )
 {
     // Phase mode
     if( pMtr->phase_mode == MTP_PHASE_FULL )    pMtr->phase_index_update_num = 2;   // FULL-STEP
+    else if( pMtr->phase_shift != 0 )           pMtr->phase_index_update_num = 2;   // HALF-STEP running as FULL-STEP
     else                                        pMtr->phase_index_update_num = 1;   // HALF-STEP
     // Direction
     if( pMtr->direction == MTD_CCW )            pMtr->phase_index_update_num *= -1;
+    // Position update (half-step counts at even phase index)
+    pMtr->position_num  = (pMtr->direction == MTD_CCW) ? -1 : 1;
+    pMtr->position_mask = (pMtr->phase_index_update_num & 1);
 }
 
-// function : Set up for Motor output status
-static void MotorSetup( MOTOR_INFO* const pMtr )
+// function : Output pins
+// Ports and pins of MOTOR_CONFIG are constants in each case, so only the phase
+// index is read at run time. BSRR is written directly (same as HAL_GPIO_WritePin()
+// without the call to flash); MOTOR_OUTPUT_PORT sets and resets 4 pins at once.
+#define MOTOR_PIN_WRITE(port, value)    (MOTOR_GPIO(port)->BSRR = (value))
+#define MOTOR_OUTPUT_CASE(id, pa1, na1, pb1, nb1, pa2, na2, pb2, nb2, pps, mode, out) \
+    case (id): \
+        if( (out) == MOTOR_OUTPUT_PORT ){ \
+            MOTOR_PIN_WRITE( pa1, MOTOR_PIN_BSRR( PHASE_A1_ON, nIndex, na1 ) | MOTOR_PIN_BSRR( PHASE_B1_ON, nIndex, nb1 ) \
+                                | MOTOR_PIN_BSRR( PHASE_A2_ON, nIndex, na2 ) | MOTOR_PIN_BSRR( PHASE_B2_ON, nIndex, nb2 ) ); \
+        }else{ \
+            MOTOR_PIN_WRITE( pa1, MOTOR_PIN_BSRR( PHASE_A1_ON, nIndex, na1 ) ); \
+            MOTOR_PIN_WRITE( pb1, MOTOR_PIN_BSRR( PHASE_B1_ON, nIndex, nb1 ) ); \
+            MOTOR_PIN_WRITE( pa2, MOTOR_PIN_BSRR( PHASE_A2_ON, nIndex, na2 ) ); \
+            MOTOR_PIN_WRITE( pb2, MOTOR_PIN_BSRR( PHASE_B2_ON, nIndex, nb2 ) ); \
+        } \
+        break;
+MOTOR_RAM_FUNC static void MotorOutput( const MOTOR_INFO* const pMtr )
 {
     // check pahse index range
     if( pMtr->phase_index > MOTOR_OFF_INDEX )   return;
 
-    uint16_t nIndex = pMtr->phase_index;
-    MOTOR_PIN_INFO* pInfo = &(pMtr->phase[0]);
-    pInfo[PHASE_A1].output = sc_OutputState[nIndex][PHASE_A1];
-    pInfo[PHASE_B1].output = sc_OutputState[nIndex][PHASE_B1];
-    pInfo[PHASE_A2].output = sc_OutputState[nIndex][PHASE_A2];
-    pInfo[PHASE_B2].output = sc_OutputState[nIndex][PHASE_B2];
-}
-
-// function : Output pins
-static void MotorOutput( const MOTOR_INFO* const pMtr )
-{
-    const MOTOR_PIN_INFO* const pInfo = &(pMtr->phase[0]);
-    HAL_GPIO_WritePin( pInfo[PHASE_A1].port, pInfo[PHASE_A1].pin, pInfo[PHASE_A1].output );
-    HAL_GPIO_WritePin( pInfo[PHASE_B1].port, pInfo[PHASE_B1].pin, pInfo[PHASE_B1].output );
-    HAL_GPIO_WritePin( pInfo[PHASE_A2].port, pInfo[PHASE_A2].pin, pInfo[PHASE_A2].output );
-    HAL_GPIO_WritePin( pInfo[PHASE_B2].port, pInfo[PHASE_B2].pin, pInfo[PHASE_B2].output );
+    uint32_t nIndex = pMtr->phase_index;
+    switch( MOTOR_NUMBER(pMtr) ){
+    MOTOR_CONFIG( MOTOR_OUTPUT_CASE )
+    default:
+        break;
+    }
 }
 
 // function : Initialize for Motor information
 void MotorInitialize( void )
 {
     MOTOR_INFO* pMtr;
+    uint32_t    now = TimerGetTick();
+    // Wiring check of MOTOR_CONFIG ("duplicate case value" : pin used twice or reserved)
+    switch( 0 ){
+    MOTOR_CONFIG( MOTOR_PIN_CASE )
+    MOTOR_RESERVED( MOTOR_RESERVED_CASE )
+    default:
+        break;
+    }
+    MotorBackupInitialize();
+    s_ArmMask  = 0;
+    s_FireMask = 0;
     for(uint16_t nMotor=0; nMotor < MOTOR_MAX; nMotor++ ){
         motors[nMotor].status        = MTS_IDLE;
         motors[nMotor].direction     = MTD_CW;
-        motors[nMotor].pps           = DEFAULT_PPS;
-        motors[nMotor].pps_timer     = CALC_PPS_TIMER_COUNT(DEFAULT_PPS);
-        motors[nMotor].phase_mode    = MTP_PHASE_FULL;
-        motors[nMotor].phase_index_update_num = 2;
+        motors[nMotor].pps           = sc_MotorDefault[nMotor].pps;
+        motors[nMotor].pps_timer     = CALC_PPS_TIMER_COUNT(sc_MotorDefault[nMotor].pps);
+        motors[nMotor].pps_count     = CALC_PPS_TIMER_COUNT(sc_MotorDefault[nMotor].pps);
+        motors[nMotor].phase_mode    = sc_MotorDefault[nMotor].phase_mode;
         motors[nMotor].phase_index   = MOTOR_OFF_INDEX;
         motors[nMotor].phase_pos     = 0;
-        motors[nMotor].break_timeout = 10,
-        motors[nMotor].break_timer = 0,
+        motors[nMotor].break_timeout = DEFAULT_BREAK_TIMEOUT;
+        motors[nMotor].break_timer   = 0;
         motors[nMotor].motor_position   = 0; 
         motors[nMotor].target_position  = 0; 
+        motors[nMotor].run_mode         = MTM_POSITION;
+        motors[nMotor].target_velocity  = 0;
+        motors[nMotor].ramp_pps         = DEFAULT_RAMP_PPS;
+        motors[nMotor].step_delta       = 0;
+        motors[nMotor].gear_master      = 0;
+        motors[nMotor].gear_num         = 1;
+        motors[nMotor].gear_den         = 1;
+        motors[nMotor].gear_acc         = 0;
+        motors[nMotor].gear_pending     = 0;
+        for(uint16_t nBand=0; nBand < RESONANCE_BAND_MAX; nBand++ ){
+            motors[nMotor].band[nBand].low  = 0;
+            motors[nMotor].band[nBand].high = 0;
+        }
+        motors[nMotor].auto_full_pps    = 0;
+        motors[nMotor].phase_shift      = 0;
+        motors[nMotor].step_num         = 0;
+        motors[nMotor].backlash         = 0;
+        motors[nMotor].backlash_pps     = DEFAULT_BACKLASH_PPS;
+        motors[nMotor].backlash_pending = 0;
+        motors[nMotor].backlash_offset  = 0;
+        MotorStatsClear( &(motors[nMotor].stats) );
+        MotorDecisionPhaseIndexUpdateNumber( &(motors[nMotor]) );
+        queues[nMotor].head             = 0;
+        queues[nMotor].tail             = 0;
+        pvts[nMotor].active             = 0;
+        pvts[nMotor].loaded             = 0;
+        pvts[nMotor].running            = 0;
+        pvts[nMotor].table[0].count     = 0;
+        pvts[nMotor].table[1].count     = 0;
+        wakes[nMotor].deadline          = now + MOTOR_SLEEP_MAX;
+        wakes[nMotor].last              = now;
+        wakes[nMotor].index             = nMotor;
+        s_WakeHeap[nMotor]              = nMotor;
         pMtr = &(motors[nMotor]);
+        // Restore position from backup (keep 0 if record is invalid)
+        MotorBackupLoad( nMotor, &(motors[nMotor].motor_position), &(motors[nMotor].phase_pos) );
         // Output Initial Position
-        motors[nMotor].phase_index   = 0;
-        MotorSetup( pMtr );
+        motors[nMotor].phase_index   = motors[nMotor].phase_pos;
         MotorOutput( pMtr );
         // Output off
         motors[nMotor].phase_index   = MOTOR_OFF_INDEX;
-        motors[nMotor].phase_pos     = 0;
-        MotorSetup( pMtr );
         MotorOutput( pMtr );
         // TEST
         //motors[nMotor].phase_mode    = MTP_PHASE_HALF;
@@ -290,46 +826,617 @@ void MotorInitialize( void )
     }
 }
 
-// function : Control for Motor output status
-void MotorControl( void )
+// function : Control for Motor output status ( return the next deadline )
+// Motors whose deadline is now (or past) are updated, in deadline order and
+// in motor number order at the same tick (gear master before the slave).
+MOTOR_RAM_FUNC uint32_t MotorControl( uint32_t now )
+{
+    MOTOR_TRACE_TICK( now );
+    s_Now = now;
+    uint16_t nMotor = s_WakeHeap[0];
+    while( (int32_t)(wakes[nMotor].deadline - now) <= 0 ){
+        MOTOR_INFO* const pMtr  = &(motors[nMotor]);
+        MOTOR_WAKE* const pWake = &(wakes[nMotor]);
+        pMtr->stats.ticks[pMtr->status] += now - pWake->last;
+        MotorSleep( pMtr, now - pWake->last - 1 );
+        MotorUpdate( pMtr );
+        pWake->last     = now;
+        pWake->deadline = now + 1 + MotorSleepTicks( pMtr );
+        MotorWakeSort( nMotor );
+        nMotor = s_WakeHeap[0];
+    }
+    // Synchronized start (after the due updates of this tick)
+    uint32_t fire = s_FireMask;
+    if( fire != 0 ){
+        s_FireMask = 0;
+        MotorFireStart( fire, now );
+    }
+    return wakes[s_WakeHeap[0]].deadline;
+}
+
+// function : Ticks after the update which only count down
+MOTOR_RAM_FUNC static uint32_t MotorSleepTicks( const MOTOR_INFO* const pMtr )
+{
+    if( pMtr->status == MTS_IDLE )  return MOTOR_SLEEP_MAX;
+    if( pMtr->status == MTS_BREAK ){
+        // queued segment is taken at the next tick
+        const MOTOR_QUEUE* const pQue = &(queues[MOTOR_NUMBER(pMtr)]);
+        if( (pQue->head != pQue->tail) || (pMtr->break_timer == 0) )    return 0;
+        return pMtr->break_timer - 1;
+    }
+    // gear and PVT follow every tick
+    if( (pMtr->run_mode == MTM_GEAR) || (pMtr->run_mode == MTM_PVT) )  return 0;
+    return (pMtr->pps_timer == pMtr->pps_count) ? 0 : pMtr->pps_timer;
+}
+
+// function : Count down of the slept ticks
+// A late update (ticks over the sleep) runs the due step now.
+MOTOR_RAM_FUNC static void MotorSleep( MOTOR_INFO* const pMtr, uint32_t ticks )
+{
+    if( ticks == 0 )    return;
+
+    if( pMtr->status == MTS_BREAK ){
+        pMtr->break_timer = (pMtr->break_timer > ticks) ? (pMtr->break_timer - ticks) : 1;
+    }
+    else if( (pMtr->status != MTS_IDLE) && (pMtr->pps_timer != pMtr->pps_count) ){
+        pMtr->pps_timer = (pMtr->pps_timer > ticks) ? (pMtr->pps_timer - ticks) : pMtr->pps_count;
+    }
+}
+
+// function : Deadline order ( return 1 : A is before B )
+MOTOR_RAM_FUNC static uint32_t MotorWakeBefore( uint16_t nMotorA, uint16_t nMotorB )
+{
+    int32_t diff = (int32_t)(wakes[nMotorA].deadline - wakes[nMotorB].deadline);
+    return ((diff < 0) || ((diff == 0) && (nMotorA < nMotorB))) ? 1 : 0;
+}
+
+// function : Move the motor to its place in the heap (after the deadline is changed)
+MOTOR_RAM_FUNC static void MotorWakeSort( uint16_t nMotor )
+{
+    uint32_t index = wakes[nMotor].index;
+    // earlier : up
+    while( index > 0 ){
+        uint32_t parent = (index - 1) / 2;
+        if( MotorWakeBefore( nMotor, s_WakeHeap[parent] ) == 0 )    break;
+        s_WakeHeap[index] = s_WakeHeap[parent];
+        wakes[s_WakeHeap[index]].index = index;
+        index = parent;
+    }
+    // later : down
+    while( ((index * 2) + 1) < MOTOR_MAX ){
+        uint32_t child = (index * 2) + 1;
+        if( ((child + 1) < MOTOR_MAX) && (MotorWakeBefore( s_WakeHeap[child + 1], s_WakeHeap[child] ) != 0) )  child++;
+        if( MotorWakeBefore( s_WakeHeap[child], nMotor ) == 0 )     break;
+        s_WakeHeap[index] = s_WakeHeap[child];
+        wakes[s_WakeHeap[index]].index = index;
+        index = child;
+    }
+    s_WakeHeap[index]    = nMotor;
+    wakes[nMotor].index  = index;
+}
+
+// function : Wake up the motor for the next tick (interrupt is disabled by caller, or in timer interrupt)
+// The slept ticks are counted down first, so the change made after this
+// starts from the next tick as with every tick update.
+MOTOR_RAM_FUNC static void MotorWake( MOTOR_INFO* const pMtr )
+{
+    uint16_t    nMotor = MOTOR_NUMBER(pMtr);
+    MOTOR_WAKE* pWake  = &(wakes[nMotor]);
+    uint32_t    now    = TimerGetTick();
+    if( (int32_t)(pWake->deadline - now) <= 0 ){
+        // due update is pending (timer interrupt) : count down until it
+        pMtr->stats.ticks[pMtr->status] += (pWake->deadline - 1) - pWake->last;
+        MotorSleep( pMtr, (pWake->deadline - 1) - pWake->last );
+        pWake->last = pWake->deadline - 1;
+        return;
+    }
+
+    MotorWakeAt( pMtr, now );
+    TimerSchedule( wakes[s_WakeHeap[0]].deadline );
+}
+
+// function : Wake up the motor for the tick after now (its update of now is done)
+MOTOR_RAM_FUNC static void MotorWakeAt( MOTOR_INFO* const pMtr, uint32_t now )
+{
+    uint16_t    nMotor = MOTOR_NUMBER(pMtr);
+    MOTOR_WAKE* pWake  = &(wakes[nMotor]);
+    pMtr->stats.ticks[pMtr->status] += now - pWake->last;
+    MotorSleep( pMtr, now - pWake->last );
+    pWake->last     = now;
+    pWake->deadline = now + 1;
+    MotorWakeSort( nMotor );
+}
+
+// function : Start the fired moves (in timer interrupt)
+MOTOR_RAM_FUNC static void MotorFireStart( uint32_t fire, uint32_t now )
 {
     for(uint16_t nMotor=0; nMotor < MOTOR_MAX; nMotor++ ){
-        MotorUpdate( &(motors[nMotor]) );
+        if( (fire & ((uint32_t)1 << nMotor)) == 0 )     continue;
+        MOTOR_INFO* const pMtr = &(motors[nMotor]);
+        MotorWakeAt( pMtr, now );
+        MotorStartMove( pMtr, s_Armed[nMotor].pps, s_Armed[nMotor].position );
+    }
+}
+
+// function : Set up position move (interrupt is disabled by caller, or in timer interrupt)
+MOTOR_RAM_FUNC static void MotorSetupSegment( MOTOR_INFO* const pMtr, uint32_t pps, int64_t position )
+{
+    // PPS Setup (start with the set phase mode)
+    pMtr->run_mode      = MTM_POSITION;
+    pMtr->pps           = pps;
+    pMtr->phase_shift   = 0;
+    pMtr->pps_count     = MOTOR_PPS_TIMER_COUNT(pMtr);
+    pMtr->pps_timer     = pMtr->pps_count;
+
+    // Direction and target position Setup
+    if( position >= pMtr->motor_position )  pMtr->direction = MTD_CW;
+    else                                    pMtr->direction = MTD_CCW;
+    pMtr->target_position = position;
+
+    // Phase Setup
+    MotorDecisionPhaseIndexUpdateNumber( pMtr );  
+
+    // Break timeout
+    pMtr->break_timeout = pMtr->pps_timer;
+
+    // Backlash take-up at reversal (phase updates)
+    if( position != pMtr->motor_position ){
+        uint32_t takeup = pMtr->backlash * ((pMtr->phase_mode == MTP_PHASE_FULL) ? 1 : 2);
+        if( (pMtr->step_num != 0) && (pMtr->step_num != pMtr->position_num) ){
+            pMtr->backlash_pending = (pMtr->backlash_pending < takeup) ? (takeup - pMtr->backlash_pending) : 0;
+        }
+        if( pMtr->backlash_pending != 0 ){
+            pMtr->pps_count = CALC_PPS_TIMER_COUNT(pMtr->backlash_pps);
+            pMtr->pps_timer = pMtr->pps_count;
+        }
     }
+
+    // Start
+    pMtr->break_timer   = pMtr->break_timeout;
+    if( position == pMtr->motor_position )  pMtr->status = MTS_BREAK;
+    else                                    pMtr->status = MTS_RUN_CONST;
 }
 
-// function : Setup for Moving
-void MotorMove( uint16_t nMotor, uint32_t pps, int32_t position )
+// function : Take the next segment from the queue ( return 1 : started )
+MOTOR_RAM_FUNC static uint32_t MotorNextSegment( MOTOR_INFO* const pMtr )
 {
+    MOTOR_QUEUE* const pQue = &(queues[MOTOR_NUMBER(pMtr)]);
+    uint32_t tail = pQue->tail;
+    if( tail == pQue->head )    return 0;
+
+    const MOTOR_SEGMENT* const pSeg = &(pQue->segment[tail & MOTOR_QUEUE_MASK]);
+    MotorSetupSegment( pMtr, pSeg->pps, pSeg->position );
+    pQue->tail = tail + 1;
+    // Planner refills the queue
+    SchedulerSignal( SEV_MOTOR );
+    return 1;
+}
+
+// function : Flush the queue (interrupt is disabled by caller, or in timer interrupt)
+MOTOR_RAM_FUNC static void MotorQueueFlush( MOTOR_INFO* const pMtr )
+{
+    MOTOR_QUEUE* const pQue = &(queues[MOTOR_NUMBER(pMtr)]);
+    pQue->tail = pQue->head;
+}
+
+// function : Setup for Moving (interrupt is disabled by caller, or in timer interrupt)
+MOTOR_RAM_FUNC static void MotorStartMove( MOTOR_INFO* const pMtr, uint32_t pps, int64_t position )
+{
+    // Backup is invalid while moving
+    if( position != pMtr->motor_position )  MotorBackupInvalidate( MOTOR_NUMBER(pMtr) );
+
+    pMtr->phase_index   = pMtr->phase_pos;
+    MotorSetupSegment( pMtr, pps, position );
+}
+
+// function : Move to absolute position
+void MotorMove( uint16_t nMotor, uint32_t pps, int64_t position )
+{
+    uint32_t primask;
     if( nMotor > (MOTOR_MAX - 1) )          return; 
     if( pps == 0 )                          return; 
     if( pps >  INTERRUPT_TIMER_INTERVAL )   return; 
 
-    // Disable Interrupt
+    pps = MotorAvoidBand( &(motors[nMotor]), pps );
 
-    // PPS Setup
-    motors[nMotor].pps          = pps;
-    motors[nMotor].pps_timer    = CALC_PPS_TIMER_COUNT(pps);
+    MOTOR_DISABLE_INTERRUPT( primask );
+    MotorWake( &(motors[nMotor]) );
+    MotorQueueFlush( &(motors[nMotor]) );
+    MotorStartMove( &(motors[nMotor]), pps, position );
+    MOTOR_ENABLE_INTERRUPT( primask );
+}
 
-    // Direction and target position Setup
-    if( position >= motors[nMotor].motor_position ) motors[nMotor].direction     = MTD_CW;
-    else                                            motors[nMotor].direction     = MTD_CCW;
-    motors[nMotor].target_position = position;
+// function : Move relative to current position
+// Target is made from the position at the start in the same critical section,
+// so steps issued by timer interrupt are not lost.
+void MotorMoveRelative( uint16_t nMotor, uint32_t pps, int32_t distance )
+{
+    uint32_t primask;
+    if( nMotor > (MOTOR_MAX - 1) )          return; 
+    if( pps == 0 )                          return; 
+    if( pps >  INTERRUPT_TIMER_INTERVAL )   return; 
 
-    // Phase Setup
-    MotorDecisionPhaseIndexUpdateNumber( &motors[nMotor] );  
+    pps = MotorAvoidBand( &(motors[nMotor]), pps );
 
-    // Break timeout
-    motors[nMotor].break_timeout = motors[nMotor].pps_timer;
+    MOTOR_DISABLE_INTERRUPT( primask );
+    MotorWake( &(motors[nMotor]) );
+    MotorQueueFlush( &(motors[nMotor]) );
+    MotorStartMove( &(motors[nMotor]), pps, motors[nMotor].motor_position + distance );
+    MOTOR_ENABLE_INTERRUPT( primask );
+}
+
+// function : Queue position move ( return 0 : queue is full )
+// Idle motor starts at once (a fired motor queues after the fired move).
+// Moving motor runs the queued moves back to
+// back (no break between segments, the timer interrupt takes the next one
+// at the last step); SEV_MOTOR is signaled when a segment is taken.
+// MotorMove / MotorMoveRelative / MotorRun / MotorGear / MotorStop cancel
+// the queued moves.
+uint32_t MotorQueueMove( uint16_t nMotor, uint32_t pps, int64_t position )
+{
+    uint32_t primask;
+    if( nMotor > (MOTOR_MAX - 1) )          return 0; 
+    if( pps == 0 )                          return 0; 
+    if( pps >  INTERRUPT_TIMER_INTERVAL )   return 0; 
+
+    MOTOR_INFO*  pMtr = &(motors[nMotor]);
+    MOTOR_QUEUE* pQue = &(queues[nMotor]);
+    pps = MotorAvoidBand( pMtr, pps );
+
+    // Motor must not become IDLE between the check and the push
+    uint32_t result = 1;
+    MOTOR_DISABLE_INTERRUPT( primask );
+    MotorWake( pMtr );
+    uint32_t head = pQue->head;
+    if( (pMtr->status == MTS_IDLE) && (head == pQue->tail) && ((s_FireMask & ((uint32_t)1 << nMotor)) == 0) ){
+        MotorStartMove( pMtr, pps, position );
+    }
+    else if( (head - pQue->tail) >= MOTOR_QUEUE_SIZE ){
+        result = 0;
+    }
+    else{
+        pQue->segment[head & MOTOR_QUEUE_MASK].pps      = pps;
+        pQue->segment[head & MOTOR_QUEUE_MASK].position = position;
+        pQue->head = head + 1;
+        if( (head + 1 - pQue->tail) > pMtr->stats.queue_max )  pMtr->stats.queue_max = head + 1 - pQue->tail;
+    }
+    MOTOR_ENABLE_INTERRUPT( primask );
+    return result;
+}
+
+// function : Get the number of queued moves
+uint32_t MotorQueueDepth( uint16_t nMotor )
+{
+    if( nMotor > (MOTOR_MAX - 1) )          return 0; 
+
+    return queues[nMotor].head - queues[nMotor].tail;
+}
+
+// function : Arm position move for synchronized start ( return 0 : invalid )
+// The move is staged until MotorFire. Arming again replaces the staged move.
+uint32_t MotorArm( uint16_t nMotor, uint32_t pps, int64_t position )
+{
+    uint32_t primask;
+    if( nMotor > (MOTOR_MAX - 1) )          return 0; 
+    if( pps == 0 )                          return 0; 
+    if( pps >  INTERRUPT_TIMER_INTERVAL )   return 0; 
+
+    pps = MotorAvoidBand( &(motors[nMotor]), pps );
+
+    MOTOR_DISABLE_INTERRUPT( primask );
+    s_Armed[nMotor].pps      = pps;
+    s_Armed[nMotor].position = position;
+    s_ArmMask |= (uint32_t)1 << nMotor;
+    MOTOR_ENABLE_INTERRUPT( primask );
+    return 1;
+}
+
+// function : Start armed moves at the same tick ( return the bits of the started motors )
+// mask : bit n is motor n. Motors without an armed move are ignored.
+// The fired motors make their first update at the same tick. The fired move
+// replaces a running move, and the queued moves run after it. A fired motor
+// is busy until the timer interrupt starts it.
+uint32_t MotorFire( uint32_t mask )
+{
+    uint32_t primask;
+    MOTOR_DISABLE_INTERRUPT( primask );
+    mask       &= s_ArmMask;
+    s_ArmMask  &= ~mask;
+    s_FireMask |= mask;
+    if( mask != 0 ){
+        // Compare timer : interrupt at the next tick (or the earlier deadline)
+        uint32_t next = TimerGetTick() + 1;
+        if( (int32_t)(wakes[s_WakeHeap[0]].deadline - next) < 0 )   next = wakes[s_WakeHeap[0]].deadline;
+        TimerSchedule( next );
+    }
+    MOTOR_ENABLE_INTERRUPT( primask );
+    return mask;
+}
+
+// function : Run at velocity (signed PPS, CW:+ CCW:-, 0:stop)
+// Running motor changes the speed with ramp at the next step boundary
+// (no stop, position keeps counting).
+void MotorRun( uint16_t nMotor, int32_t pps )
+{
+    if( nMotor > (MOTOR_MAX - 1) )          return; 
+    if( pps >  (int32_t)INTERRUPT_TIMER_INTERVAL )    return; 
+    if( pps < -(int32_t)INTERRUPT_TIMER_INTERVAL )    return; 
+
+    MOTOR_INFO* pMtr = &(motors[nMotor]);
+    uint32_t primask;
+
+    // Cruise speed out of resonance bands
+    if( pps > 0 )   pps =  (int32_t)MotorAvoidBand( pMtr, (uint32_t)pps );
+    if( pps < 0 )   pps = -(int32_t)MotorAvoidBand( pMtr, (uint32_t)(-pps) );
+
+    // Queued moves are cancelled, and the speed is changed (picked up by
+    // timer interrupt at the next step, run mode and target together)
+    MOTOR_DISABLE_INTERRUPT( primask );
+    MotorWake( pMtr );
+    MotorQueueFlush( pMtr );
+    pMtr->target_velocity = pps;
+    MotorLeavePosition( pMtr );
+    pMtr->run_mode        = MTM_VELOCITY;
+    uint32_t running = ((pMtr->status >= MTS_RUN_ACCEL) && (pMtr->status <= MTS_RUN_DECEL)) ? 1 : 0;
+    MOTOR_ENABLE_INTERRUPT( primask );
+    if( running != 0 )  return;
+    if( pps == 0 )      return;
+
+    MOTOR_DISABLE_INTERRUPT( primask );
+    MotorWake( pMtr );
+
+    // Start from the minimum PPS
+    pMtr->pps           = RUN_PPS_MIN;
+    pMtr->phase_shift   = 0;
+    pMtr->pps_count     = CALC_PPS_TIMER_COUNT(RUN_PPS_MIN);
+    pMtr->pps_timer     = pMtr->pps_count;
+    pMtr->break_timeout = pMtr->pps_timer;
+    pMtr->direction     = (pps > 0) ? MTD_CW : MTD_CCW;
+    MotorDecisionPhaseIndexUpdateNumber( pMtr );
+
+    // Backup is invalid while moving
+    MotorBackupInvalidate( nMotor );
+
+    // Start
+    pMtr->phase_index   = pMtr->phase_pos;
+    pMtr->break_timer   = pMtr->break_timeout;
+    pMtr->status        = MTS_RUN_ACCEL;
+
+    MOTOR_ENABLE_INTERRUPT( primask );
+}
+
+// function : Set resonance band ( low < pps < high is not used for cruise, low = high = 0 : clear )
+void MotorSetResonanceBand( uint16_t nMotor, uint16_t nBand, uint32_t low, uint32_t high )
+{
+    if( nMotor > (MOTOR_MAX - 1) )          return; 
+    if( nBand > (RESONANCE_BAND_MAX - 1) )  return; 
+    if( low > high )                        return; 
+
+    motors[nMotor].band[nBand].low  = low;
+    motors[nMotor].band[nBand].high = high;
+}
+
+// function : Set automatic Full-step switching PPS (Half-step mode only, 0 : not used)
+void MotorSetAutoPhase( uint16_t nMotor, uint32_t pps )
+{
+    if( nMotor > (MOTOR_MAX - 1) )          return; 
+    if( pps >  INTERRUPT_TIMER_INTERVAL )   return; 
+
+    motors[nMotor].auto_full_pps = pps;
+}
+
+// function : Follow master motor at gear ratio (num / den, num < 0 : reverse)
+// Gearing is stopped with MotorStop().
+void MotorGear( uint16_t nMotor, uint16_t nMaster, int32_t num, int32_t den )
+{
+    uint32_t primask;
+    if( nMotor > (MOTOR_MAX - 1) )  return; 
+    if( nMaster >= nMotor )         return; 
+    if( den <= 0 )                  return; 
+
+    MOTOR_INFO* pMtr = &(motors[nMotor]);
+    MOTOR_DISABLE_INTERRUPT( primask );
+
+    MotorWake( pMtr );
+    MotorQueueFlush( pMtr );
+    MotorLeavePosition( pMtr );
+    pMtr->run_mode      = MTM_GEAR;
+    pMtr->gear_master   = nMaster;
+    pMtr->gear_num      = num;
+    pMtr->gear_den      = den;
+    pMtr->gear_acc      = 0;
+    pMtr->gear_pending  = 0;
+    pMtr->phase_shift   = 0;
+    pMtr->break_timeout = DEFAULT_BREAK_TIMEOUT;
+    MotorDecisionPhaseIndexUpdateNumber( pMtr );
+
+    // Backup is invalid while moving
+    MotorBackupInvalidate( nMotor );
 
     // Start
-    motors[nMotor].phase_index  = motors[nMotor].phase_pos;
-    motors[nMotor].break_timer  = motors[nMotor].break_timeout;
-    if( position == motors[nMotor].motor_position ) motors[nMotor].status = MTS_BREAK;
-    else                                            motors[nMotor].status = MTS_RUN_CONST;
+    pMtr->phase_index   = pMtr->phase_pos;
+    pMtr->break_timer   = pMtr->break_timeout;
+    pMtr->status        = MTS_RUN_CONST;
+
+    MOTOR_ENABLE_INTERRUPT( primask );
+}
 
-    // Enable Interrupt
+// function : Division rounded to nearest (den > 0)
+static int64_t MotorPvtDivide( int64_t num, int64_t den )
+{
+    return (num >= 0) ? ((num + (den / 2)) / den) : -((-num + (den / 2)) / den);
+}
+
+// function : Check the peak velocity inside a segment ( return 1 : over the limit )
+// Velocity of the cubic at s = t / T (0 - 1), V : PPS, P : steps, T : ticks
+//   V(s) * T = 3X s^2 + 2Y s + V0 T,  X = -2P I + (V0 + V1)T,  Y = 3P I - (2V0 + V1)T
+// (I : ticks per second). The ends are V0 and V1 (checked by the caller),
+// so only the vertex s = -Y / 3X is checked when it is inside the segment:
+//   V(vertex) * T = V0 T - Y^2 / 3X
+// All terms fit in int64 when the ends and the average are in the limit.
+static uint32_t MotorPvtPeakOver( int32_t v0, int32_t v1, int32_t position, int32_t ticks, int32_t limit )
+{
+    int64_t t = ticks;
+    int64_t x = (-2 * (int64_t)position * INTERRUPT_TIMER_INTERVAL) + (((int64_t)v0 + v1) * t);
+    int64_t y = (3 * (int64_t)position * INTERRUPT_TIMER_INTERVAL) - (((2 * (int64_t)v0) + v1) * t);
+    int64_t ax = (x < 0) ? -x : x;
+    int64_t ay = (x < 0) ? y : -y;
+    // vertex inside (0, 1) : 0 < -Y / 3X < 1
+    if( (ay <= 0) || (ay >= (3 * ax)) )  return 0;
 
+    // |V0 T 3X - Y^2| > limit T 3|X|
+    int64_t peak = ((int64_t)v0 * t * 3 * x) - (y * y);
+    if( peak < 0 )  peak = -peak;
+    return (peak > ((int64_t)limit * t * 3 * ax)) ? 1 : 0;
+}
+
+// function : Load PVT table ( return 0 : invalid table, or a table is already waiting )
+// The table is loaded to the slot which is not running. A running motor
+// switches to it at the end of the cycle, an idle motor starts it with
+// MotorPvtStart(). Points are relative to the previous point; the 1st
+// segment starts at the velocity of the last point (a table is a cycle).
+// The motor follows with 1 phase update per tick, so the average of each
+// segment, the velocity at each point and the peak velocity inside each
+// segment must not exceed 1 step per tick (FULL-STEP) or 1 step per 2 ticks
+// (HALF-STEP) of the current phase mode.
+uint32_t MotorPvtLoad( uint16_t nMotor, const MOTOR_PVT_POINT* pPoint, uint16_t count, uint32_t repeat )
+{
+    if( nMotor > (MOTOR_MAX - 1) )                      return 0; 
+    if( (count == 0) || (count > MOTOR_PVT_POINT_MAX) ) return 0; 
+
+    MOTOR_PVT* pPvt = &(pvts[nMotor]);
+    if( pPvt->loaded != 0 )     return 0;
+    int32_t unit = (motors[nMotor].phase_mode == MTP_PHASE_FULL) ? 1 : 2;
+    int32_t last = pPoint[count - 1].velocity;
+    for(uint16_t nPoint=0; nPoint < count; nPoint++ ){
+        if( (pPoint[nPoint].time == 0) || (pPoint[nPoint].time > PVT_TIME_MAX) )   return 0;
+        int32_t ticks    = (int32_t)(((uint32_t)pPoint[nPoint].time * INTERRUPT_TIMER_INTERVAL) / 1000);
+        int32_t position = (pPoint[nPoint].position < 0) ? -pPoint[nPoint].position : pPoint[nPoint].position;
+        int32_t velocity = (pPoint[nPoint].velocity < 0) ? -pPoint[nPoint].velocity : pPoint[nPoint].velocity;
+        if( (position * unit) > ticks )                                 return 0;
+        if( (velocity * unit) > (int32_t)INTERRUPT_TIMER_INTERVAL )     return 0;
+        if( MotorPvtPeakOver( last, pPoint[nPoint].velocity, pPoint[nPoint].position, ticks, (int32_t)INTERRUPT_TIMER_INTERVAL / unit ) != 0 )   return 0;
+        last = pPoint[nPoint].velocity;
+    }
+
+    // Cubic of each segment to forward differences (1 tick)
+    //   a = (-2P + (V0 + V1)T) / T^3,  b = (3P - (2V0 + V1)T) / T^2
+    //   d1 = a + b + V0,  d2 = 6a + 2b,  d3 = 6a
+    MOTOR_PVT_TABLE* pTable = &(pPvt->table[pPvt->active ^ 1]);
+    int64_t v0 = ((int64_t)pPoint[count - 1].velocity << PVT_FRACTION) / INTERRUPT_TIMER_INTERVAL;
+    for(uint16_t nPoint=0; nPoint < count; nPoint++ ){
+        MOTOR_PVT_SEGMENT* pSeg = &(pTable->segment[nPoint]);
+        int64_t t  = ((int64_t)pPoint[nPoint].time * INTERRUPT_TIMER_INTERVAL) / 1000;
+        int64_t p  = (int64_t)pPoint[nPoint].position << PVT_FRACTION;
+        int64_t v1 = ((int64_t)pPoint[nPoint].velocity << PVT_FRACTION) / INTERRUPT_TIMER_INTERVAL;
+        int64_t a  = MotorPvtDivide( (-2 * p) + ((v0 + v1) * t), t * t * t );
+        int64_t b  = MotorPvtDivide( (3 * p) - (((2 * v0) + v1) * t), t * t );
+        pSeg->d1    = a + b + v0;
+        pSeg->d2    = (6 * a) + (2 * b);
+        pSeg->d3    = 6 * a;
+        pSeg->delta = pPoint[nPoint].position;
+        pSeg->ticks = (uint32_t)t;
+        v0 = v1;
+    }
+    pTable->count  = count;
+    pTable->repeat = repeat;
+    pTable->unit   = (uint32_t)unit;
+    __DMB();
+    pPvt->loaded   = 1;
+    return 1;
+}
+
+// function : Start PVT table (IDLE or BREAK only, return 0 : not started)
+// The loaded table is started (or the last table again) from the current position.
+uint32_t MotorPvtStart( uint16_t nMotor )
+{
+    uint32_t primask;
+    if( nMotor > (MOTOR_MAX - 1) )  return 0; 
+
+    MOTOR_INFO* pMtr = &(motors[nMotor]);
+    MOTOR_PVT*  pPvt = &(pvts[nMotor]);
+    MOTOR_DISABLE_INTERRUPT( primask );
+    if( (pMtr->status != MTS_IDLE) && (pMtr->status != MTS_BREAK) ){
+        MOTOR_ENABLE_INTERRUPT( primask );
+        return 0;
+    }
+    if( pPvt->loaded != 0 ){
+        pPvt->active ^= 1;
+        pPvt->loaded  = 0;
+    }
+    if( pPvt->table[pPvt->active].count == 0 ){
+        MOTOR_ENABLE_INTERRUPT( primask );
+        return 0;
+    }
+    // Table checked for FULL-STEP is too fast for HALF-STEP
+    if( ((pMtr->phase_mode == MTP_PHASE_FULL) ? 1 : 2) > pPvt->table[pPvt->active].unit ){
+        MOTOR_ENABLE_INTERRUPT( primask );
+        return 0;
+    }
+
+    MotorWake( pMtr );
+    MotorQueueFlush( pMtr );
+    MotorLeavePosition( pMtr );
+    pMtr->run_mode      = MTM_PVT;
+    pMtr->phase_shift   = 0;
+    pMtr->break_timeout = DEFAULT_BREAK_TIMEOUT;
+    MotorDecisionPhaseIndexUpdateNumber( pMtr );
+    pPvt->running = 1;
+    pPvt->segment = 0;
+    pPvt->cycles  = 0;
+    pPvt->base    = pMtr->motor_position;
+    pPvt->target  = pMtr->motor_position;
+    MotorPvtSegment( pPvt );
+
+    // Backup is invalid while moving
+    MotorBackupInvalidate( nMotor );
+
+    // Start
+    pMtr->phase_index   = pMtr->phase_pos;
+    pMtr->break_timer   = pMtr->break_timeout;
+    pMtr->status        = MTS_RUN_CONST;
+
+    MOTOR_ENABLE_INTERRUPT( primask );
+    return 1;
+}
+
+// function : Get completed cycles of PVT table
+uint32_t MotorPvtCycles( uint16_t nMotor )
+{
+    if( nMotor > (MOTOR_MAX - 1) )  return 0; 
+
+    return pvts[nMotor].cycles;
+}
+
+// function : Set ramp (PPS change per step in velocity mode)
+void MotorSetRamp( uint16_t nMotor, uint32_t ramp_pps )
+{
+    if( nMotor > (MOTOR_MAX - 1) ) return; 
+    if( ramp_pps == 0 )            return; 
+
+    motors[nMotor].ramp_pps = ramp_pps;
+}
+
+// function : Set backlash compensation (positions, 0 : not compensated)
+// pps : PPS of the take-up (0 : not changed)
+void MotorSetBacklash( uint16_t nMotor, uint32_t backlash, uint32_t pps )
+{
+    uint32_t primask;
+    if( nMotor > (MOTOR_MAX - 1) )          return; 
+    if( pps >  INTERRUPT_TIMER_INTERVAL )   return; 
+
+    MOTOR_DISABLE_INTERRUPT( primask );
+    motors[nMotor].backlash = backlash;
+    if( pps != 0 )  motors[nMotor].backlash_pps = pps;
+    MOTOR_ENABLE_INTERRUPT( primask );
+}
+
+// function : Get backlash offset (rotor position - motor position, by take-up)
+MOTOR_RAM_FUNC int32_t MotorGetBacklashOffset( uint16_t nMotor )
+{
+    if( nMotor > (MOTOR_MAX - 1) )  return 0;
+
+    return motors[nMotor].backlash_offset;
 }
 
 // function : Check for motor busy
@@ -337,22 +1444,178 @@ uint32_t MotorIsBusy( uint16_t nMotor )
 {
     if( nMotor > (MOTOR_MAX - 1) ) return 0; 
 
+    if( (s_FireMask & ((uint32_t)1 << nMotor)) != 0 )   return 1;
     return (motors[nMotor].status == MTS_IDLE) ? 0 : 1;
 }
 
+// function : Stop moving (output is kept for breaking timeout)
+// HALF-STEP between the counted positions completes the half step first
+// (position move of 1, at the current PPS), so a reversed move counts right.
+// A backlash take-up stops at once (the rest is kept pending).
+void MotorStop( uint16_t nMotor )
+{
+    uint32_t primask;
+    if( nMotor > (MOTOR_MAX - 1) ) return; 
+
+    MOTOR_INFO* pMtr = &(motors[nMotor]);
+    MOTOR_DISABLE_INTERRUPT( primask );
+    MotorWake( pMtr );
+    MotorQueueFlush( pMtr );
+    // Armed and fired moves are cancelled
+    s_ArmMask  &= ~((uint32_t)1 << nMotor);
+    s_FireMask &= ~((uint32_t)1 << nMotor);
+    if( (pMtr->status != MTS_IDLE) && (pMtr->status != MTS_BREAK) ){
+        if( ((pMtr->phase_index & pMtr->position_mask) != 0) && (pMtr->backlash_pending == 0) ){
+            pMtr->run_mode        = MTM_POSITION;
+            pMtr->target_position = pMtr->motor_position + pMtr->position_num;
+            pMtr->break_timer     = pMtr->break_timeout;
+            pMtr->status          = MTS_RUN_DECEL;
+        }
+        else{
+            pMtr->target_position = pMtr->motor_position;
+            pMtr->break_timer     = pMtr->break_timeout;
+            pMtr->status          = MTS_BREAK;
+        }
+    }
+    MOTOR_ENABLE_INTERRUPT( primask );
+}
+
+// function : Get Position
+// 64bit position is read twice until both are same, so the value is not torn
+// by timer interrupt (no need to disable interrupt).
+MOTOR_RAM_FUNC int64_t MotorGetPosition( uint16_t nMotor )
+{
+    if( nMotor > (MOTOR_MAX - 1) ) return 0; 
+
+    volatile const int64_t* const pPosition = &(motors[nMotor].motor_position);
+    int64_t position;
+    do{
+        position = *pPosition;
+    }while( position != *pPosition );
+    return position;
+}
+
+// function : Get motor state (consistent with the timer interrupt)
+void MotorGetState( uint16_t nMotor, MOTOR_STATE* const pState )
+{
+    uint32_t primask;
+    if( nMotor > (MOTOR_MAX - 1) )  return;
+
+    const MOTOR_INFO* pMtr = &(motors[nMotor]);
+    MOTOR_DISABLE_INTERRUPT( primask );
+    pState->motor_position  = pMtr->motor_position;
+    pState->target_position = pMtr->target_position;
+    pState->status          = pMtr->status;
+    pState->run_mode        = pMtr->run_mode;
+    pState->queue_depth     = queues[nMotor].head - queues[nMotor].tail;
+    MOTOR_ENABLE_INTERRUPT( primask );
+}
+
+// function : Get statistics (consistent with the timer interrupt)
+// The counters are copied with interrupt disabled. Ticks after the last
+// update of a sleeping motor are added to the current status.
+void MotorGetStats( uint16_t nMotor, MOTOR_STATS* const pStats )
+{
+    uint32_t primask;
+    if( nMotor > (MOTOR_MAX - 1) )  return;
+
+    const MOTOR_INFO* pMtr = &(motors[nMotor]);
+    MOTOR_DISABLE_INTERRUPT( primask );
+    *pStats         = pMtr->stats;
+    uint32_t status = pMtr->status;
+    uint32_t ticks  = TimerGetTick() - wakes[nMotor].last;
+    MOTOR_ENABLE_INTERRUPT( primask );
+    pStats->ticks[status] += ticks;
+}
+
+// function : Reset statistics
+void MotorResetStats( uint16_t nMotor )
+{
+    uint32_t primask;
+    if( nMotor > (MOTOR_MAX - 1) )  return;
+
+    MOTOR_DISABLE_INTERRUPT( primask );
+    // ticks until now are counted before clear
+    MotorWake( &(motors[nMotor]) );
+    MotorStatsClear( &(motors[nMotor].stats) );
+    MOTOR_ENABLE_INTERRUPT( primask );
+}
+
+// function : Clear statistics
+static void MotorStatsClear( MOTOR_STATS* const pStats )
+{
+    pStats->steps       = 0;
+    pStats->moves       = 0;
+    for(uint16_t nStatus=0; nStatus < MOTOR_STATS_STATUS; nStatus++ ){
+        pStats->ticks[nStatus] = 0;
+    }
+    pStats->queue_max   = 0;
+    pStats->reversals   = 0;
+}
+
+// function : Set Position
+void MotorSetPosition( uint16_t nMotor, int64_t position )
+{
+    uint32_t primask;
+    if( nMotor > (MOTOR_MAX - 1) ) return; 
+
+    MOTOR_DISABLE_INTERRUPT( primask );
+    MotorEncoderSetPosition( nMotor, position );
+    motors[nMotor].motor_position = position;
+    if( motors[nMotor].status == MTS_IDLE ) MotorBackupSave( nMotor, position, motors[nMotor].phase_pos );
+    MOTOR_ENABLE_INTERRUPT( primask );
+}
+
 // function : Reset Position
 void MotorResetPosition( uint16_t nMotor )
 {
+    MotorSetPosition( nMotor, 0 );
+}
+
+// function : Reset phase position to index 0 (IDLE only, rotor may jump to the phase)
+// The side of the backlash is not known after the jump (no take-up at the next move).
+void MotorResetPhase( uint16_t nMotor )
+{
+    uint32_t primask;
     if( nMotor > (MOTOR_MAX - 1) ) return; 
+    if( motors[nMotor].status != MTS_IDLE ) return;
+
+    MOTOR_DISABLE_INTERRUPT( primask );
+    motors[nMotor].phase_pos        = 0;
+    motors[nMotor].step_num         = 0;
+    motors[nMotor].backlash_pending = 0;
+    MOTOR_ENABLE_INTERRUPT( primask );
+}
 
-    motors[nMotor].motor_position = 0;
+// function : Get output pins state (bit0:A1 bit1:B1 bit2:A2 bit3:B2)
+#define MOTOR_PIN_READ(port, pin, nPhase)   (((MOTOR_GPIO(port)->ODR >> (pin)) & 1u) << (nPhase))
+#define MOTOR_GET_OUTPUT_CASE(id, pa1, na1, pb1, nb1, pa2, na2, pb2, nb2, pps, mode, out) \
+    case (id): \
+        output = MOTOR_PIN_READ( pa1, na1, PHASE_A1 ) | MOTOR_PIN_READ( pb1, nb1, PHASE_B1 ) \
+               | MOTOR_PIN_READ( pa2, na2, PHASE_A2 ) | MOTOR_PIN_READ( pb2, nb2, PHASE_B2 ); \
+        break;
+uint32_t MotorGetOutput( uint16_t nMotor )
+{
+    if( nMotor > (MOTOR_MAX - 1) ) return 0; 
+
+    uint32_t output = 0;
+    switch( nMotor ){
+    MOTOR_CONFIG( MOTOR_GET_OUTPUT_CASE )
+    default:
+        break;
+    }
+    return output;
 }
 
 // function : Set for Phase Mode
 void MotorSetPhaseMode( uint16_t nMotor, PHASE_MODE phase_mode )
 {
+    uint32_t primask;
     if( nMotor > (MOTOR_MAX - 1) ) return; 
     if( (MTP_PHASE_FULL != phase_mode) && (MTP_PHASE_HALF != phase_mode) ) return; 
 
+    MOTOR_DISABLE_INTERRUPT( primask );
     motors[nMotor].phase_mode = phase_mode;
+    MotorDecisionPhaseIndexUpdateNumber( &(motors[nMotor]) );
+    MOTOR_ENABLE_INTERRUPT( primask );
 }
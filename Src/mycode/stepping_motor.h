@@ -1,13 +1,125 @@
 
+// Interrupt Timer interval
+#define INTERRUPT_TIMER_INTERVAL    (1000)    // 1000ms / Interrupt interval(ms)
+
+// Motor configuration
+// 1 line per motor, in motor number order :
+//   X( motor number, A1 port, A1 pin, B1 port, B1 pin, A2 port, A2 pin, B2 port, B2 pin,
+//      default PPS, phase mode, output )
+//   port   : GPIO port letter (A, B, C, D, E, H), pin : 0 - 15
+//   output : MOTOR_OUTPUT_PINS  4 BSRR writes (pins on any ports)
+//            MOTOR_OUTPUT_PORT  1 BSRR write (4 pins on 1 port)
+// The output code of each motor is made from this table with constant
+// ports and pins (stepping_motor.c). Wiring errors stop the compile : pin
+// out of range, pin used twice or by the other functions (MOTOR_RESERVED),
+// MOTOR_OUTPUT_PORT with pins on different ports, default PPS out of range.
+// The pins must be GPIO outputs in CubeMX (MX_GPIO_Init).
+#define MOTOR_CONFIG(X) \
+    X( 0,   A, 10,  B, 5,   A, 8,   A, 9,   1000,   MTP_PHASE_FULL, MOTOR_OUTPUT_PINS ) \
+    X( 1,   C, 0,   C, 1,   C, 2,   C, 3,   1000,   MTP_PHASE_FULL, MOTOR_OUTPUT_PORT )
+
+// Output
+#define MOTOR_OUTPUT_PINS   (0)
+#define MOTOR_OUTPUT_PORT   (1)
+
+// Pins of the other functions (not for motors)
+//   PA0 : LIMIT0, PA2 PA3 : USART2, PA6 PA7 : TIM3 encoder, PA13 PA14 : SWD, PC13 : B1
+#define MOTOR_RESERVED(X) \
+    X( A, 0 )   X( A, 2 )   X( A, 3 )   X( A, 6 )   X( A, 7 )   X( A, 13 )  X( A, 14 )  X( C, 13 )
+
+// the number of motors
+#define MOTOR_COUNT_ONE(...)    + 1
+#define MOTOR_MAX       (0 MOTOR_CONFIG( MOTOR_COUNT_ONE ))
+
+// Segment queue of MotorQueueMove() (segments per motor, power of 2)
+#define MOTOR_QUEUE_SIZE    (8)
+
+// PVT table (points per table, 2 tables per motor)
+#define MOTOR_PVT_POINT_MAX (64)
+
+// Timer interrupt path in RAM
+// 1 : functions and tables of the timer interrupt path are placed in RAM
+//     (no flash wait state). They are copied at start-up with initialized
+//     data by the CubeMX linker file
+//     EWARM : __ramfunc ( .textrw, tables stay in flash )
+//     GCC   : .RamFunc and .data.* sections
+// 0 : run from flash
+#define MOTOR_RAM_ENABLE    (1)
+
+#if MOTOR_RAM_ENABLE && defined(__ICCARM__)
+#define MOTOR_RAM_FUNC      __ramfunc
+#define MOTOR_RAM_CONST
+#elif MOTOR_RAM_ENABLE
+#define MOTOR_RAM_FUNC      __attribute__((section(".RamFunc")))
+#define MOTOR_RAM_CONST     __attribute__((section(".data.motor_const")))
+#else
+#define MOTOR_RAM_FUNC
+#define MOTOR_RAM_CONST
+#endif
+
+// Disable / Enable Interrupt (nesting is allowed)
+#define MOTOR_DISABLE_INTERRUPT(primask)    do{ (primask) = __get_PRIMASK(); __disable_irq(); }while(0)
+#define MOTOR_ENABLE_INTERRUPT(primask)     __set_PRIMASK( (primask) )
+
 // Phase mode
 typedef enum {
     MTP_PHASE_FULL     = 0,  // FULL-STEP Phase mode
     MTP_PHASE_HALF,          // HALF-STEP Phase mode
 }PHASE_MODE;
 
+// Motor state (MotorGetState)
+typedef struct {
+    int64_t             motor_position;         // motor position
+    int64_t             target_position;        // target position (position mode)
+    uint32_t            status;                 // motor status (0:IDLE 1:ACCEL 2:CONST 3:DECEL 4:BREAK)
+    uint32_t            run_mode;               // run mode (0:POSITION 1:VELOCITY 2:GEAR 3:PVT)
+    uint32_t            queue_depth;            // queued moves
+}MOTOR_STATE;
+
+// Motor statistics (MotorGetStats, counted from MotorInitialize or MotorResetStats)
+// Counters wrap around at 2^32 (ticks : 49 days).
+#define MOTOR_STATS_STATUS  (5)
+typedef struct {
+    uint32_t            steps;                  // phase updates output
+    uint32_t            moves;                  // position moves which reached the target (each queued move counts)
+    uint32_t            ticks[MOTOR_STATS_STATUS];  // ticks in each status (0:IDLE 1:ACCEL 2:CONST 3:DECEL 4:BREAK)
+    uint32_t            queue_max;              // max queued moves
+    uint32_t            reversals;              // direction changes between 2 steps
+}MOTOR_STATS;
+
+// PVT point (MotorPvtLoad, relative to the previous point)
+typedef struct {
+    int16_t             position;               // position change (steps)
+    int16_t             velocity;               // velocity at the point (signed PPS)
+    uint16_t            time;                   // time from the previous point (ms, 1 - 10000)
+}MOTOR_PVT_POINT;
+
 void MotorInitialize( void );
-void MotorControl( void );
-void MotorMove( uint16_t nMotor, uint32_t pps, int32_t position );
+uint32_t MotorControl( uint32_t now );
+void MotorMove( uint16_t nMotor, uint32_t pps, int64_t position );
+void MotorMoveRelative( uint16_t nMotor, uint32_t pps, int32_t distance );
+uint32_t MotorQueueMove( uint16_t nMotor, uint32_t pps, int64_t position );
+uint32_t MotorQueueDepth( uint16_t nMotor );
+uint32_t MotorArm( uint16_t nMotor, uint32_t pps, int64_t position );
+uint32_t MotorFire( uint32_t mask );
+void MotorRun( uint16_t nMotor, int32_t pps );
+void MotorSetRamp( uint16_t nMotor, uint32_t ramp_pps );
+void MotorSetBacklash( uint16_t nMotor, uint32_t backlash, uint32_t pps );
+int32_t MotorGetBacklashOffset( uint16_t nMotor );
+void MotorSetResonanceBand( uint16_t nMotor, uint16_t nBand, uint32_t low, uint32_t high );
+void MotorGear( uint16_t nMotor, uint16_t nMaster, int32_t num, int32_t den );
+uint32_t MotorPvtLoad( uint16_t nMotor, const MOTOR_PVT_POINT* pPoint, uint16_t count, uint32_t repeat );
+uint32_t MotorPvtStart( uint16_t nMotor );
+uint32_t MotorPvtCycles( uint16_t nMotor );
 uint32_t MotorIsBusy( uint16_t nMotor );
+void MotorStop( uint16_t nMotor );
+int64_t MotorGetPosition( uint16_t nMotor );
+void MotorGetState( uint16_t nMotor, MOTOR_STATE* const pState );
+void MotorGetStats( uint16_t nMotor, MOTOR_STATS* const pStats );
+void MotorResetStats( uint16_t nMotor );
+void MotorSetPosition( uint16_t nMotor, int64_t position );
 void MotorResetPosition( uint16_t nMotor );
-void MotorSetPhaseMode( uint16_t nMotor, PHASE_MODE phase_mode );
\ No newline at end of file
+void MotorSetPhaseMode( uint16_t nMotor, PHASE_MODE phase_mode );
+void MotorSetAutoPhase( uint16_t nMotor, uint32_t pps );
+void MotorResetPhase( uint16_t nMotor );
+uint32_t MotorGetOutput( uint16_t nMotor );
\ No newline at end of file
@@ -2,16 +2,97 @@
 #include "interrupt_timer.h"
 #include "interrupt_button.h"
 #include "stepping_motor.h"
+#include "motor_home.h"
+#include "motor_encoder.h"
+#include "motor_trace.h"
+#include "motor_bench.h"
+#include "motor_wave.h"
+#include "motor_telemetry.h"
+#include "motor_gcode.h"
+#include "motor_pvt.h"
+#include "motor_stats.h"
+#include "serial_port.h"
+#include "input_port.h"
+#include "scheduler.h"
+#include "user_main.h"
 
 // My Initialization Code
 void UserInitialize( void )
 {
+    SchedulerInitialize();
     MotorInitialize();
+    MotorEncoderInitialize();
+    MotorGcodeInitialize();
+    SerialInitialize();
+    InputInitialize();
     TimerInitialize();
 }
 
+// Serial command
+//   'T' : dump motion trace (binary)
+//   'B' : run benchmark of timer interrupt path (JSON)
+//   'W' : record coil waveform of fixed moves (text)
+//   'L' : CPU load of tasks (JSON)
+//   'S' : start / stop telemetry streaming (binary frames)
+//   'P' : upload PVT table (binary frame follows, motor_pvt.c)
+//   'C' : motor statistics (JSON)
+//   'R' : reset motor statistics
+// Other characters are G-code lines (motor_gcode.c).
+// ( return 1 : command is executed )
+static uint32_t CommandProcess( uint8_t command )
+{
+    switch( command ){
+        default:
+            return 0;
+        case 'T':
+            MotorTraceDump();
+            break;
+        case 'B':
+            MotorBenchRun();
+            break;
+        case 'W':
+            MotorWaveRun();
+            break;
+        case 'L':
+            SchedulerReport();
+            break;
+        case 'S':
+            MotorTelemetrySetRate( (MotorTelemetryGetRate() == 0) ? TELEMETRY_DEFAULT_RATE : 0 );
+            break;
+        case 'P':
+            MotorPvtUploadBegin();
+            break;
+        case 'C':
+            MotorStatsReport();
+            break;
+        case 'R':
+            MotorStatsReset();
+            break;
+    }
+    return 1;
+}
+
+// Serial command task (woken up by received data and taken segments)
+// Receiving stops while a G-code line waits for the motion queue.
+void UserCommand( void )
+{
+    uint8_t data;
+    while( MotorGcodeReady() != 0 ){
+        if( MotorPvtUploadActive() != 0 ){
+            // PVT table frame
+            if( SerialRead( &data ) == 0 )  break;
+            MotorPvtUploadInput( data );
+            continue;
+        }
+        if( SerialRead( &data ) == 0 )  break;
+        // 1 letter command at the beginning of a line
+        if( (MotorGcodeLength() == 0) && (CommandProcess( data ) != 0) )    continue;
+        MotorGcodeInput( data );
+    }
+}
+
 // My Main Code
 void UserMain( void )
 {
-    button_loop();
+    SchedulerRun();
 }
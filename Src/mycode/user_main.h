@@ -1,4 +1,6 @@
 // My Initialization Code
 void UserInitialize( void );
 // My Main Code
-void UserMain( void );
\ No newline at end of file
+void UserMain( void );
+// Serial command task
+void UserCommand( void );
\ No newline at end of file
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+# Timer interrupt benchmark reader
+# Reads the JSON line of the 'B' serial command (see
+# Src/mycode/motor_bench.c) and compares it with a baseline result.
+#
+#   bench_compare.py --port /dev/ttyACM0 --save result.json   (needs pyserial)
+#   bench_compare.py result.json --baseline baseline.json --tolerance 5
+#
+# Exit status is 1 when cycles_mean or cycles_max of any scenario is
+# worse than the baseline by more than the tolerance (%).
+import argparse
+import json
+import sys
+
+
+def read_port(port, baud):
+    import serial
+    with serial.Serial(port, baud, timeout=30) as link:
+        link.reset_input_buffer()
+        link.write(b"B")
+        return link.readline().decode("ascii")
+
+
+def build_info(result):
+    # flash wait states and timer interrupt path in RAM (older results have neither)
+    return "core_hz=%s flash_latency=%s ram_func=%s" % (
+        result.get("core_hz"), result.get("flash_latency", "?"), result.get("ram_func", "?"))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="read and compare motor_control benchmark")
+    parser.add_argument("file", nargs="?", help="benchmark JSON file")
+    parser.add_argument("--port", help="serial port (sends 'B' and reads the result)")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--save", help="save the result JSON")
+    parser.add_argument("--baseline", help="baseline JSON to compare with")
+    parser.add_argument("--tolerance", type=float, default=5.0, help="allowed regression (%%)")
+    args = parser.parse_args()
+
+    if args.port:
+        text = read_port(args.port, args.baud)
+    elif args.file:
+        with open(args.file) as f:
+            text = f.read()
+    else:
+        text = sys.stdin.read()
+    result = json.loads(text)
+    if args.save:
+        with open(args.save, "w") as f:
+            json.dump(result, f, indent=2)
+
+    print("result   : %s" % build_info(result))
+    base = {}
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        print("baseline : %s" % build_info(baseline))
+        base = {r["name"]: r for r in baseline["results"]}
+
+    failed = False
+    print("%-10s %10s %10s %10s %12s %12s" % ("scenario", "mean", "max", "var", "ns/tick", "ns/step"))
+    for r in result["results"]:
+        note = ""
+        ref = base.get(r["name"])
+        if ref:
+            for key in ("cycles_mean", "cycles_max"):
+                limit = ref[key] * (1.0 + args.tolerance / 100.0)
+                if r[key] > limit:
+                    note += " %s %d > %d" % (key, r[key], ref[key])
+                    failed = True
+        print("%-10s %10d %10d %10d %12d %12d%s" % (r["name"], r["cycles_mean"], r["cycles_max"],
+                                                    r["cycles_var"], r["ns_per_tick"], r["ns_per_step"],
+                                                    "  REGRESSION" + note if note else ""))
+
+    # TIM2 interrupt entry : HAL_TIM_IRQHandler() vs fast path
+    named = {r["name"]: r for r in result["results"]}
+    if "irq_hal" in named and "irq_fast" in named:
+        saved = named["irq_hal"]["cycles_mean"] - named["irq_fast"]["cycles_mean"]
+        print("irq fast path saves %d cycles/tick (mean)" % saved)
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,101 @@
+// G-code parser throughput (host)
+// Parses a G-code file line by line with GcodeParse() (Src/mycode/gcode_parser.c)
+// and prints the throughput as 1 line of JSON. Without a file, a generated
+// program of typical G1 lines is used.
+//
+//   cc -O2 -ISrc/mycode -o gcode_bench tools/gcode_bench.c Src/mycode/gcode_parser.c
+//   ./gcode_bench part.gcode [repeat]
+//   ./gcode_bench
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gcode_parser.h"
+
+#define BENCH_GENERATED_LINES   (1000000)   // lines of the generated program
+#define BENCH_DEFAULT_REPEAT    (5)
+
+// function : Read whole file ( return NULL : error )
+static char* BenchLoad( const char* pPath, size_t* pSize )
+{
+    FILE* pFile = fopen( pPath, "rb" );
+    if( pFile == NULL )     return NULL;
+    fseek( pFile, 0, SEEK_END );
+    long size = ftell( pFile );
+    fseek( pFile, 0, SEEK_SET );
+    char* pData = malloc( (size_t)size + 1 );
+    if( (pData != NULL) && (fread( pData, 1, (size_t)size, pFile ) != (size_t)size) ){
+        free( pData );
+        pData = NULL;
+    }
+    fclose( pFile );
+    *pSize = (size_t)size;
+    return pData;
+}
+
+// function : Generate a program of G1 lines
+static char* BenchGenerate( size_t* pSize )
+{
+    char*  pData = malloc( (size_t)BENCH_GENERATED_LINES * 48 );
+    size_t size  = 0;
+    if( pData == NULL )     return NULL;
+    for(uint32_t nLine=0; nLine < BENCH_GENERATED_LINES; nLine++ ){
+        size += (size_t)sprintf( pData + size, "G1 X%u.%03u Y-%u.%03u F%u ; move\n",
+                                 nLine % 300, (nLine * 7) % 1000, nLine % 200, (nLine * 13) % 1000, 600 + (nLine % 4) * 300 );
+    }
+    *pSize = size;
+    return pData;
+}
+
+// function : Parse all lines ( return the number of lines )
+static uint32_t BenchParse( const char* pData, size_t size, uint32_t* pErrors, int64_t* pSum )
+{
+    GCODE_BLOCK block;
+    uint32_t    lines = 0;
+    size_t      start = 0;
+    for(size_t pos=0; pos <= size; pos++ ){
+        if( (pos < size) && (pData[pos] != '\n') && (pData[pos] != '\r') )  continue;
+        if( pos > start ){
+            GCODE_PARSE parse = GcodeParse( pData + start, (uint32_t)(pos - start), &block );
+            if( (parse != GCP_OK) && (parse != GCP_EMPTY) )     (*pErrors)++;
+            // use the result (not optimized out)
+            if( GCODE_HAS_WORD( &block, 'X' ) )     *pSum += GCODE_WORD( &block, 'X' );
+            lines++;
+        }
+        start = pos + 1;
+    }
+    return lines;
+}
+
+int main( int argc, char** argv )
+{
+    size_t   size;
+    char*    pData  = (argc > 1) ? BenchLoad( argv[1], &size ) : BenchGenerate( &size );
+    uint32_t repeat = (argc > 2) ? (uint32_t)atoi( argv[2] ) : BENCH_DEFAULT_REPEAT;
+    if( pData == NULL ){
+        fprintf( stderr, "cannot read %s\n", (argc > 1) ? argv[1] : "generated program" );
+        return 1;
+    }
+    if( repeat == 0 )   repeat = 1;
+
+    uint32_t lines  = 0;
+    uint32_t errors = 0;
+    int64_t  sum    = 0;
+    double   best   = 0;
+    for(uint32_t nRepeat=0; nRepeat < repeat; nRepeat++ ){
+        struct timespec start, end;
+        errors = 0;
+        clock_gettime( CLOCK_MONOTONIC, &start );
+        lines = BenchParse( pData, size, &errors, &sum );
+        clock_gettime( CLOCK_MONOTONIC, &end );
+        double sec = (double)(end.tv_sec - start.tv_sec) + ((double)(end.tv_nsec - start.tv_nsec) / 1e9);
+        if( (nRepeat == 0) || (sec < best) )    best = sec;
+    }
+
+    printf( "{\"bench\":\"gcode_parse\",\"bytes\":%zu,\"lines\":%u,\"errors\":%u,\"best_s\":%.6f,"
+            "\"lines_per_s\":%.0f,\"mb_per_s\":%.1f,\"ns_per_line\":%.1f,\"check\":%lld}\n",
+            size, lines, errors, best, lines / best, (size / best) / 1e6, (best * 1e9) / lines, (long long)sum );
+    free( pData );
+    return 0;
+}
@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+# Telemetry decoder
+# Decodes the frames of the 'S' serial command (see
+# Src/mycode/motor_telemetry.c) to CSV. Bytes between frames (other command
+# output, noise) are skipped; frames are checked with the CRC.
+#
+#   telemetry_decode.py --port /dev/ttyACM0 --count 100 > tlm.csv   (needs pyserial)
+#   telemetry_decode.py capture.bin > tlm.csv
+#   telemetry_decode.py --selftest   (encode -> pty -> decode loopback)
+import argparse
+import os
+import struct
+import sys
+
+STATUS = ["IDLE", "RUN_ACCEL", "RUN_CONST", "RUN_DECEL", "BREAK"]
+MODE = ["POSITION", "VELOCITY", "GEAR", "PVT"]
+VERSION = 1
+HEADER = struct.Struct("<2sBBHHIHH")
+MOTOR = struct.Struct("<iiiBBBB")
+TRAILER = struct.Struct("<HH")
+
+
+def crc16(data):
+    # CRC-16/CCITT-FALSE
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def frame_size(motors):
+    return HEADER.size + MOTOR.size * motors + TRAILER.size
+
+
+def encode(frame):
+    motors = frame["motors"]
+    data = HEADER.pack(b"TL", VERSION, len(motors), frame["sequence"], frame["isr_load"],
+                       frame["tick"], frame["dropped"], frame_size(len(motors)))
+    for motor in motors:
+        data += MOTOR.pack(motor["position"], motor["target"], motor["pps"],
+                           motor["status"], motor["mode"], motor["queue"], 0)
+    return data + TRAILER.pack(crc16(data), 0)
+
+
+class Decoder:
+    def __init__(self):
+        self.buffer = b""
+        self.skipped = 0
+
+    def feed(self, data):
+        self.buffer += data
+        frames = []
+        while True:
+            start = self.buffer.find(b"TL")
+            if start < 0:
+                # keep the last byte (it may be 'T')
+                keep = 1 if self.buffer.endswith(b"T") else 0
+                self.skipped += len(self.buffer) - keep
+                self.buffer = self.buffer[len(self.buffer) - keep:]
+                return frames
+            self.skipped += start
+            self.buffer = self.buffer[start:]
+            if len(self.buffer) < HEADER.size:
+                return frames
+            _, version, motors, _, _, _, _, size = HEADER.unpack_from(self.buffer)
+            if version != VERSION or size != frame_size(motors):
+                self.skip(1)
+                continue
+            if len(self.buffer) < size:
+                return frames
+            crc, _ = TRAILER.unpack_from(self.buffer, size - TRAILER.size)
+            if crc != crc16(self.buffer[:size - TRAILER.size]):
+                self.skip(1)
+                continue
+            frames.append(self.parse(self.buffer[:size]))
+            self.buffer = self.buffer[size:]
+
+    def skip(self, size):
+        self.skipped += size
+        self.buffer = self.buffer[size:]
+
+    @staticmethod
+    def parse(data):
+        _, _, motors, sequence, isr_load, tick, dropped, _ = HEADER.unpack_from(data)
+        frame = {"sequence": sequence, "isr_load": isr_load, "tick": tick, "dropped": dropped, "motors": []}
+        for n in range(motors):
+            position, target, pps, status, mode, queue, _ = MOTOR.unpack_from(data, HEADER.size + MOTOR.size * n)
+            frame["motors"].append({"position": position, "target": target, "pps": pps,
+                                    "status": status, "mode": mode, "queue": queue})
+        return frame
+
+
+def write_header(out):
+    out.write("sequence,tick,isr_load,dropped,motor,position,target,pps,status,mode,queue\n")
+
+
+def write_frame(out, frame):
+    for n, motor in enumerate(frame["motors"]):
+        status = STATUS[motor["status"]] if motor["status"] < len(STATUS) else str(motor["status"])
+        mode = MODE[motor["mode"]] if motor["mode"] < len(MODE) else str(motor["mode"])
+        out.write("%d,%d,%d,%d,%d,%d,%d,%d,%s,%s,%d\n" % (
+            frame["sequence"], frame["tick"], frame["isr_load"], frame["dropped"], n,
+            motor["position"], motor["target"], motor["pps"], status, mode, motor["queue"]))
+
+
+def decode(read, out, count):
+    decoder = Decoder()
+    received = 0
+    write_header(out)
+    while count == 0 or received < count:
+        data = read()
+        if not data:
+            break
+        for frame in decoder.feed(data):
+            write_frame(out, frame)
+            received += 1
+            if received == count:
+                break
+    return received
+
+
+def selftest():
+    import tty
+
+    frames = []
+    for n in range(20):
+        frames.append({"sequence": n, "isr_load": 10 + n, "tick": 100 * n, "dropped": n // 5, "motors": [
+            {"position": n * 10, "target": 200, "pps": 100, "status": 2, "mode": 0, "queue": n % 8},
+            {"position": -n * 20, "target": 0, "pps": -200, "status": 1, "mode": 1, "queue": 0}]})
+    # other command output and a broken frame between frames
+    stream = b"{\"window_ms\":1000}\r\n"
+    for n, frame in enumerate(frames):
+        data = encode(frame)
+        if n == 7:
+            stream += data[:-3] + b"\x00"
+        stream += data + (b"TLx" if n % 3 == 0 else b"")
+
+    master, slave = os.openpty()
+    tty.setraw(slave)
+    os.write(master, stream)
+    decoder = Decoder()
+    received = []
+    while len(received) < len(frames):
+        received += decoder.feed(os.read(slave, 256))
+    os.close(master)
+    os.close(slave)
+
+    if received != frames:
+        print("selftest NG : %d frames decoded" % len(received))
+        return 1
+    print("selftest OK : %d frames, %d bytes skipped" % (len(received), decoder.skipped))
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="decode telemetry frames to CSV")
+    parser.add_argument("file", nargs="?", help="binary capture file")
+    parser.add_argument("--port", help="serial port or pty (sends 'S' to start and stop streaming)")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--count", type=int, default=0, help="frames to decode (0 : until end / Ctrl-C)")
+    parser.add_argument("--selftest", action="store_true", help="loopback test through a pty")
+    args = parser.parse_args()
+
+    if args.selftest:
+        sys.exit(selftest())
+    if args.port:
+        import serial
+        with serial.Serial(args.port, args.baud, timeout=2) as port:
+            port.reset_input_buffer()
+            port.write(b"S")
+            try:
+                decode(lambda: port.read(256), sys.stdout, args.count)
+            except KeyboardInterrupt:
+                pass
+            port.write(b"S")
+    elif args.file:
+        with open(args.file, "rb") as stream:
+            decode(lambda: stream.read(4096), sys.stdout, args.count)
+    else:
+        decode(lambda: sys.stdin.buffer.read(4096), sys.stdout, args.count)
+
+
+if __name__ == "__main__":
+    main()
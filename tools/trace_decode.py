@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+# Motion trace decoder
+# Converts the binary dump of the 'T' serial command (see
+# Src/mycode/motor_trace.c) to CSV.
+#
+#   trace_decode.py dump.bin > trace.csv
+#   trace_decode.py --port /dev/ttyACM0 > trace.csv   (needs pyserial)
+import argparse
+import struct
+import sys
+
+STATUS = ["IDLE", "RUN_ACCEL", "RUN_CONST", "RUN_DECEL", "BREAK"]
+RECORD = struct.Struct("<IiBBH")
+
+
+def read_exact(stream, size):
+    data = b""
+    while len(data) < size:
+        chunk = stream.read(size - len(data))
+        if not chunk:
+            raise EOFError("trace dump is truncated")
+        data += chunk
+    return data
+
+
+def decode(stream, out):
+    magic, version, motors, size, _ = struct.unpack("<4sBBBB", read_exact(stream, 8))
+    if magic != b"MTRC":
+        raise ValueError("not a trace dump")
+    if version != 1 or size != RECORD.size:
+        raise ValueError("unsupported trace version %d (record %d bytes)" % (version, size))
+
+    out.write("motor,tick,status,phase_index,position\n")
+    for _ in range(motors):
+        motor, count = struct.unpack("<HH", read_exact(stream, 4))
+        for _ in range(count):
+            tick, position, status, index, _ = RECORD.unpack(read_exact(stream, RECORD.size))
+            name = STATUS[status] if status < len(STATUS) else str(status)
+            out.write("%d,%d,%s,%d,%d\n" % (motor, tick, name, index, position))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="decode motion trace dump to CSV")
+    parser.add_argument("file", nargs="?", help="binary dump file")
+    parser.add_argument("--port", help="serial port (sends 'T' and reads the dump)")
+    parser.add_argument("--baud", type=int, default=115200)
+    args = parser.parse_args()
+
+    if args.port:
+        import serial
+        with serial.Serial(args.port, args.baud, timeout=2) as port:
+            port.reset_input_buffer()
+            port.write(b"T")
+            decode(port, sys.stdout)
+    elif args.file:
+        with open(args.file, "rb") as stream:
+            decode(stream, sys.stdout)
+    else:
+        decode(sys.stdin.buffer, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+# Coil waveform compare
+# Compares a recording of the 'W' serial command (see
+# Src/mycode/motor_wave.c) with the golden recording (tools/golden/wave.txt,
+# full-step, half-step, CW/CCW and zero-length moves) tick by tick.
+#
+#   wave_compare.py --port /dev/ttyACM0 --save after.txt   (needs pyserial)
+#   wave_compare.py after.txt
+#   wave_compare.py before.txt after.txt
+#
+# The golden file is changed only when the waveform is changed on purpose
+# (record it with --save). Lines starting with '#' are comments.
+# "encoder ok/error" lines (step loss cases) must be the same as the golden.
+#
+# Exit status is 1 when any case differs.
+import argparse
+import os
+import sys
+
+GOLDEN = os.path.join(os.path.dirname(os.path.abspath(__file__)), "golden", "wave.txt")
+
+
+def parse(lines):
+    cases = {}
+    checks = {}
+    name = None
+    for line in lines:
+        words = line.split()
+        if not words or words[0].startswith("#"):
+            continue
+        if words[0] == "case":
+            name = words[1]
+            cases[name] = []
+        elif words[0] == "end":
+            name = None
+        elif words[0] == "encoder":
+            checks[name] = words[1]
+        elif name is not None:
+            cases[name].extend([int(words[0], 16)] * int(words[1]))
+    return cases, checks
+
+
+def record(port, baud):
+    import serial
+    lines = []
+    with serial.Serial(port, baud, timeout=5) as link:
+        link.reset_input_buffer()
+        link.write(b"W")
+        while True:
+            line = link.readline().decode("ascii")
+            if not line:
+                break
+            lines.append(line.rstrip("\r\n"))
+    return lines
+
+
+def main():
+    parser = argparse.ArgumentParser(description="compare coil waveform recordings")
+    parser.add_argument("files", nargs="*", help="[reference] actual recording (reference : golden file)")
+    parser.add_argument("--port", help="serial port (sends 'W' and records the actual waveform)")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--save", help="save the recorded waveform")
+    args = parser.parse_args()
+
+    if args.port:
+        lines = record(args.port, args.baud)
+        if args.save:
+            with open(args.save, "w") as f:
+                f.write("\n".join(lines) + "\n")
+        actual, actual_checks = parse(lines)
+        reference_file = args.files[0] if args.files else GOLDEN
+    else:
+        if len(args.files) not in (1, 2):
+            parser.error("1 or 2 recordings are needed without --port")
+        with open(args.files[-1]) as f:
+            actual, actual_checks = parse(f)
+        reference_file = args.files[0] if len(args.files) == 2 else GOLDEN
+    with open(reference_file) as f:
+        reference, reference_checks = parse(f)
+
+    failed = False
+    for name, ref in reference.items():
+        act = actual.get(name)
+        if act is None:
+            print("%-10s missing" % name)
+            failed = True
+            continue
+        diff = next((n for n, (a, b) in enumerate(zip(ref, act)) if a != b), None)
+        if diff is None and len(ref) != len(act):
+            diff = min(len(ref), len(act))
+        check = actual_checks.get(name)
+        if check != reference_checks.get(name):
+            print("%-10s encoder %s" % (name, check))
+            failed = True
+        elif diff is None:
+            print("%-10s ok (%d ticks)" % (name, len(ref)))
+        else:
+            want = "%X" % ref[diff] if diff < len(ref) else "-"
+            got = "%X" % act[diff] if diff < len(act) else "-"
+            print("%-10s differs at tick %d : expected %s, got %s" % (name, diff, want, got))
+            failed = True
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())